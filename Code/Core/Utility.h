@@ -3,6 +3,7 @@
 #include <string>
 #include <memory>
 #include <array>
+#include <malloc.h>
 
 
 #define SHAKURAS_BEGIN namespace shakuras {
@@ -30,4 +31,49 @@ void UnstableErase(std::vector<T>& vec, size_t pos, size_t count) {
 }
 
 
+//for std::vector, storage aligned to ALIGN bytes
+template<class T, size_t ALIGN>
+class AlignedAllocator {
+public:
+	typedef T value_type;
+
+	template<class U>
+	struct rebind {
+		typedef AlignedAllocator<U, ALIGN> other;
+	};
+
+public:
+	AlignedAllocator() {}
+
+	template<class U>
+	AlignedAllocator(const AlignedAllocator<U, ALIGN>&) {}
+
+public:
+	T* allocate(size_t n) {
+		void* p = _aligned_malloc(n * sizeof(T), ALIGN);
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return (T*)p;
+	}
+
+	void deallocate(T* p, size_t) {
+		_aligned_free(p);
+	}
+};
+
+template<class T, class U, size_t ALIGN>
+inline bool operator==(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&) {
+	return true;
+}
+template<class T, class U, size_t ALIGN>
+inline bool operator!=(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&) {
+	return false;
+}
+
+
+//64 bytes, one cache line
+static const size_t kCacheLineSize = 64;
+
+
 SHAKURAS_END;
\ No newline at end of file
@@ -3,9 +3,11 @@
 
 
 #include <vector>
+#include <string>
 #include "SoftRenderer\SoftPhongShading.h"
 #include "Core\Application.h"
 #include "ResourceParser\TextureLoader.h"
+#include "ResourceParser\MipChain.h"
 #include "PlatformSpec\WinViewer.h"
 
 
@@ -15,12 +17,7 @@ using namespace shakuras;
 namespace soft_aniso {
 
 	SoftMipmapU32F3Ptr LoadMipmap(std::string tex_full_path) {
-		SoftSurfaceU32F3Ptr surface = std::make_shared<SoftSurfaceU32F3>();
-		int texw = 0, texh = 0;
-		void* bits = LoadTexture(tex_full_path, true, texw, texh);
-		surface->reset(texw, texh, (uint32_t*)bits, Swap02);
-		ResFree(bits);
-		return CreateSoftMipmap(surface);
+		return LoadSoftMipmap(tex_full_path, true);
 	}
 
 	SoftMipmapU32F3Ptr GridMipmap() {
@@ -31,7 +28,7 @@ namespace soft_aniso {
 		return CreateSoftMipmap(surface);
 	}
 
-	void GeneratePlane(SoftPhongPrimitiveList& prims) {
+	void GeneratePlane(SoftPhongPrimitiveList16& prims) {
 		const float size = 500;
 		const float z_value = -20;
 		const float uv_value = 20;
@@ -57,24 +54,26 @@ namespace soft_aniso {
 			p3.attribs.normal = norm;
 			p4.attribs.normal = norm;
 
-			size_t index = prims.verts_.size();
+			uint16_t index = (uint16_t)prims.verts_.size();
 			prims.verts_.push_back(p1);
 			prims.verts_.push_back(p2);
 			prims.verts_.push_back(p3);
 			prims.indexs_.push_back(index);
-			prims.indexs_.push_back(index + 1);
-			prims.indexs_.push_back(index + 2);
+			prims.indexs_.push_back(uint16_t(index + 1));
+			prims.indexs_.push_back(uint16_t(index + 2));
 
-			index = prims.verts_.size();
+			index = (uint16_t)prims.verts_.size();
 			prims.verts_.push_back(p3);
 			prims.verts_.push_back(p4);
 			prims.verts_.push_back(p1);
 			prims.indexs_.push_back(index);
-			prims.indexs_.push_back(index + 1);
-			prims.indexs_.push_back(index + 2);
+			prims.indexs_.push_back(uint16_t(index + 1));
+			prims.indexs_.push_back(uint16_t(index + 2));
 		};
 
 		draw_plane(0, 1, 2, 3);
+
+		prims.streamPositions();
 	}
 
 	class AppStage {
@@ -86,6 +85,7 @@ namespace soft_aniso {
 			texlist_.push_back(GridMipmap());
 			itex_ = 0;
 			nspace_ = 0;
+			nbudget_ = 0;
 
 			GeneratePlane(output_.prims);
 			proj_ = Matrix44f::Perspective(kGSPI * 0.6f, w / h, 1.0f, 500.0f);//ͶӰ任
@@ -97,22 +97,34 @@ namespace soft_aniso {
 			alpha_ = 0.0f;
 			pos_ = 3.5f;
 			sample_cat_ = 0;
+			max_aniso_ = MAX_ANISOTROPY;
 
 			viewer_ = viewer;
 
 			return true;
 		}
 
-		void process(std::vector<SoftPhongDrawCall>& cmds) {
+		void process(std::vector<SoftPhongDrawCall16>& cmds) {
 			if (viewer_->testUserMessage(kUMSpace)) {
 				if (++nspace_ == 1) {
-					sample_cat_ = (sample_cat_ + 1) % 4;
+					sample_cat_ = (sample_cat_ + 1) % 5;
 				}
 			}
 			else {
 				nspace_ = 0;
 			}
 
+			//tap budget 1, 2, 4 ... MAX_ANISOTROPY
+			if (viewer_->testUserMessage(kUMUp) || viewer_->testUserMessage(kUMDown)) {
+				if (++nbudget_ == 1) {
+					if (viewer_->testUserMessage(kUMUp)) max_aniso_ = (std::min)(max_aniso_ * 2, MAX_ANISOTROPY);
+					else max_aniso_ = (std::max)(max_aniso_ / 2, 1);
+				}
+			}
+			else {
+				nbudget_ = 0;
+			}
+
 			Vector3f eye(0, -3 - pos_, 2.0f), at(0, 0, 0), up(0, 0, 1);
 			Vector3f eye_pos = eye;
 			Vector3f light_dir(-1.0f, -1.0f, 1.0f);
@@ -126,6 +138,7 @@ namespace soft_aniso {
 			output_.uniforms.eye_pos = eye_pos;//λ
 			output_.uniforms.light_dir = light_dir;//Դλ
 			output_.uniforms.sample_cat = sample_cat_;
+			output_.uniforms.max_aniso = max_aniso_;
 
 			cmds.push_back(output_);
 		}
@@ -141,7 +154,9 @@ namespace soft_aniso {
 			case SoftSampler::kTrilinear:
 				return "Trilinear";
 			case SoftSampler::kAniso:
-				return "Aniso";
+				return "Aniso x" + std::to_string(output_.uniforms.max_aniso);
+			case SoftSampler::kAnisoTrilinear:
+				return "Aniso Trilinear x" + std::to_string(output_.uniforms.max_aniso);
 			default:
 				return "";
 			}
@@ -149,24 +164,26 @@ namespace soft_aniso {
 
 	public:
 		WinMemViewerPtr viewer_;
-		SoftPhongDrawCall output_;
+		SoftPhongDrawCall16 output_;
 		Matrix44f proj_;
 		std::vector<SoftMipmapU32F3Ptr> texlist_;
 		int itex_;
 		int nspace_;
+		int nbudget_;
 		int sample_cat_;
+		int max_aniso_;
 		float alpha_;
 		float pos_;
 	};
 
-	typedef shakuras::Application<SoftPhongDrawCall, AppStage, SoftPhongRenderStage> Application;
+	typedef shakuras::Application<SoftPhongDrawCall16, AppStage, SoftPhongRenderStage16> Application;
 }
 
 
 int main()
 {
 	const char *title = "ShakurasRenderer - "
-		"Left/Right: rotation, Up/Down: forward/backward, Space: switch texture";
+		"Up/Down: anisotropy budget, Space: switch sampler";
 
 	int width = 1024, height = 768;
 	WinMemViewerPtr viewer = std::make_shared<WinMemViewer>();
@@ -177,6 +194,7 @@ int main()
 	soft_aniso::Application app;
 	app.initialize(viewer);
 	app.renstage_.geostage_.refuseBack(false);
+	SoftTextureCache::enable(true);//report texture fetch locality
 
 	while (!viewer->testUserMessage(kUMEsc) && !viewer->testUserMessage(kUMClose)) {
 		viewer->dispatch();
@@ -3,6 +3,7 @@
 
 
 #include <vector>
+#include <map>
 #include "OpenGLRenderer\GlPreset.h"
 #include "OpenGLRenderer\GlBatch.h"
 #include "OpenGLRenderer\GlDrawCall.h"
@@ -10,6 +11,7 @@
 #include "OpenGLRenderer\GlContextBinding.h"
 #include "Core\Application.h"
 #include "ResourceParser\TextureLoader.h"
+#include "ResourceParser\TextureCache.h"
 #include "ResourceParser\ObjParser.h"
 #include "PlatformSpec\WinViewer.h"
 
@@ -19,12 +21,11 @@ using namespace shakuras;
 
 namespace opengl_sponza {
 
-	GlMipmapPtr LoadMipmap(std::string tex_full_path) {
-		int texw = 0, texh = 0;
-		void* bits = LoadTexture(tex_full_path, false, texw, texh);
-		GlMipmapPtr mipmap = CreateGlMipmap(bits, texw, texh);
-		ResFree(bits);
-		return mipmap;
+	GlMipmapPtr LoadMipmap(TextureImagePtr image) {
+		if (!image) {
+			return CreateGlMipmap(nullptr, 0, 0);
+		}
+		return CreateGlMipmap(image->bits, image->width, image->height);
 	}
 
 
@@ -176,14 +177,23 @@ namespace opengl_sponza {
 				return false;
 			}
 
-			std::vector<ObjMesh> meshs;
-			LoadObjMesh("Sponza/sponza.obj", meshs, false);
+			ObjModelView model;
+			LoadObjModelView("Sponza/sponza.obj", model, false);
 
 			batchs_.clear();
 			shifters_.clear();
 
-			for (size_t i = 0; i != meshs.size(); i++) {
-				const ObjMesh& mesh = meshs[i];
+			//unique files are decoded in parallel, uploads stay on this thread
+			TextureCache<TextureImage> images([](const std::string& tex_path) {
+				return LoadTextureImage(tex_path, false);
+			});
+			for (size_t i = 0; i != model.subsets.size(); i++) {
+				images.request(model.subsets[i].mtl.tex_full_path, false);
+			}
+			std::map<TextureImagePtr, GlMipmapPtr> mipmaps;
+
+			for (size_t i = 0; i != model.subsets.size(); i++) {
+				const ObjSubset& mesh = model.subsets[i];
 	
 				GlVAOFactory factory;
 
@@ -193,8 +203,8 @@ namespace opengl_sponza {
 				factory.registerAttrib(SponzaProgram::kVertNormal, 3);
 				factory.registerAttrib(SponzaProgram::kVertUV, 2);
 
-				for (size_t ii = 0; ii != mesh.verts.size(); ii++) {
-					const ObjVert& objv = mesh.verts[ii];
+				for (size_t ii = 0; ii != mesh.vert_count; ii++) {
+					const ObjVert& objv = model.verts[mesh.vert_start + ii];
 
 					factory.addVertex();
 
@@ -203,10 +213,11 @@ namespace opengl_sponza {
 					factory.setAttrib2fv(SponzaProgram::kVertUV, objv.uv.data());
 				}
 
-				for (size_t ii = 0; ii < mesh.tris.size(); ii += 3) {
-					factory.addIndex((unsigned int)mesh.tris[ii]);
-					factory.addIndex((unsigned int)mesh.tris[ii + 1]);
-					factory.addIndex((unsigned int)mesh.tris[ii + 2]);
+				const uint32_t* tris = model.indices + mesh.index_start;
+				for (size_t ii = 0; ii < mesh.index_count; ii += 3) {
+					factory.addIndex(tris[ii]);
+					factory.addIndex(tris[ii + 1]);
+					factory.addIndex(tris[ii + 2]);
 				}
 
 				GlVAOPtr batch = factory.createVAO();
@@ -214,7 +225,12 @@ namespace opengl_sponza {
 				SponzaProgramShifterPtr shifter = std::make_shared<SponzaProgramShifter>();
 				shifter->program_ = program_;
 
-				shifter->tex_ = LoadMipmap(mesh.mtl.tex_full_path);
+				TextureImagePtr image = images.get(mesh.mtl.tex_full_path, false);
+				GlMipmapPtr& mipmap = mipmaps[image];
+				if (!mipmap) {
+					mipmap = LoadMipmap(image);
+				}
+				shifter->tex_ = mipmap;
 				shifter->ambient_ = mesh.mtl.ambient;
 				shifter->diffuse_ = mesh.mtl.diffuse;
 				shifter->specular_ = mesh.mtl.specular;
@@ -6,6 +6,7 @@
 #include "SoftRenderer\SoftPhongShading.h"
 #include "Core\Application.h"
 #include "ResourceParser\TextureLoader.h"
+#include "ResourceParser\MipChain.h"
 #include "PlatformSpec\WinViewer.h"
 
 
@@ -15,12 +16,7 @@ using namespace shakuras;
 namespace soft_cube {
 
 	SoftMipmapU32F3Ptr LoadMipmap(std::string tex_full_path) {
-		SoftSurfaceU32F3Ptr surface = std::make_shared<SoftSurfaceU32F3>();
-		int texw = 0, texh = 0;
-		void* bits = LoadTexture(tex_full_path, true, texw, texh);
-		surface->reset(texw, texh, (uint32_t*)bits, Swap02);
-		ResFree(bits);
-		return CreateSoftMipmap(surface);
+		return LoadSoftMipmap(tex_full_path, true);
 	}
 
 	SoftMipmapU32F3Ptr GridMipmap() {
@@ -31,7 +27,7 @@ namespace soft_cube {
 		return CreateSoftMipmap(surface);
 	}
 
-	void GenerateCube(SoftPhongPrimitiveList& prims) {
+	void GenerateCube(SoftPhongPrimitiveList16& prims) {
 		static SoftPhongVertex mesh[8] = {
 			{ { -1, -1, -1, 1 } },
 			{ { 1, -1, -1, 1 } },
@@ -57,21 +53,21 @@ namespace soft_cube {
 			p3.attribs.normal = norm;
 			p4.attribs.normal = norm;
 
-			size_t index = prims.verts_.size();
+			uint16_t index = (uint16_t)prims.verts_.size();
 			prims.verts_.push_back(p1);
 			prims.verts_.push_back(p2);
 			prims.verts_.push_back(p3);
 			prims.indexs_.push_back(index);
-			prims.indexs_.push_back(index + 1);
-			prims.indexs_.push_back(index + 2);
+			prims.indexs_.push_back(uint16_t(index + 1));
+			prims.indexs_.push_back(uint16_t(index + 2));
 
-			index = prims.verts_.size();
+			index = (uint16_t)prims.verts_.size();
 			prims.verts_.push_back(p3);
 			prims.verts_.push_back(p4);
 			prims.verts_.push_back(p1);
 			prims.indexs_.push_back(index);
-			prims.indexs_.push_back(index + 1);
-			prims.indexs_.push_back(index + 2);
+			prims.indexs_.push_back(uint16_t(index + 1));
+			prims.indexs_.push_back(uint16_t(index + 2));
 		};
 
 		draw_plane(0, 3, 2, 1);
@@ -80,6 +76,8 @@ namespace soft_cube {
 		draw_plane(1, 2, 6, 5);
 		draw_plane(2, 3, 7, 6);
 		draw_plane(0, 4, 7, 3);
+
+		prims.streamPositions();
 	}
 
 	class AppStage {
@@ -110,7 +108,7 @@ namespace soft_cube {
 			return true;
 		}
 
-		void process(std::vector<SoftPhongDrawCall>& cmds) {
+		void process(std::vector<SoftPhongDrawCall16>& cmds) {
 			if (viewer_->testUserMessage(kUMSpace)) {
 				if (++nspace_ == 1) {
 					itex_ = (itex_ + 1) % texlist_.size();
@@ -142,7 +140,7 @@ namespace soft_cube {
 
 	private:
 		WinMemViewerPtr viewer_;
-		SoftPhongDrawCall output_;
+		SoftPhongDrawCall16 output_;
 		Matrix44f proj_;
 		std::vector<SoftMipmapU32F3Ptr> texlist_;
 		int itex_;
@@ -151,7 +149,7 @@ namespace soft_cube {
 		float pos_;
 	};
 
-	typedef shakuras::Application<SoftPhongDrawCall, AppStage, SoftPhongRenderStage> Application;
+	typedef shakuras::Application<SoftPhongDrawCall16, AppStage, SoftPhongRenderStage16> Application;
 }
 
 
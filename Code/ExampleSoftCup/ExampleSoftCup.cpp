@@ -4,6 +4,7 @@
 #include "SoftRenderer\SoftPhongShading.h"
 #include "Core\Application.h"
 #include "ResourceParser\TextureLoader.h"
+#include "ResourceParser\MipChain.h"
 #include "PlatformSpec\WinViewer.h"
 #include "ResourceParser\ObjParser.h"
 
@@ -19,19 +20,19 @@ namespace soft_cup {
 			float w = (float)viewer->width();
 			float h = (float)viewer->height();
 
-			std::vector<ObjMesh> meshs;
-			LoadObjMesh("Cup/cup.obj", meshs, false);
+			ObjModelView model;
+			LoadObjModelView("Cup/cup.obj", model, false);
 
 			outputs_.clear();
-			outputs_.resize(meshs.size());
+			outputs_.resize(model.subsets.size());
 
-			for (size_t i = 0; i != meshs.size(); i++) {
-				const ObjMesh& mesh = meshs[i];
+			for (size_t i = 0; i != model.subsets.size(); i++) {
+				const ObjSubset& mesh = model.subsets[i];
 				SoftPhongDrawCall& cmd = outputs_[i];
 
-				cmd.prims.verts_.resize(mesh.verts.size());
-				for (size_t ii = 0; ii != mesh.verts.size(); ii++) {
-					const ObjVert& objv = mesh.verts[ii];
+				cmd.prims.verts_.resize(mesh.vert_count);
+				for (size_t ii = 0; ii != mesh.vert_count; ii++) {
+					const ObjVert& objv = model.verts[mesh.vert_start + ii];
 					SoftPhongVertex& v = cmd.prims.verts_[ii];
 
 					v.pos.set(objv.pos.x, objv.pos.y, objv.pos.z, 1.0f);
@@ -39,18 +40,13 @@ namespace soft_cup {
 					v.attribs.normal = objv.normal;
 				}
 
-				cmd.prims.indexs_ = mesh.tris;
+				cmd.prims.streamPositions();
+				cmd.prims.indexs_.assign(model.indices + mesh.index_start, model.indices + mesh.index_start + mesh.index_count);
+				BuildClusters(cmd.prims);
 
 				proj_ = Matrix44f::Perspective(kGSPI * 0.5f, w / h, 0.5f, 500.0f);//ͶӰ任
 
-				int texw = 0, texh = 0;
-				void* bits = LoadTexture(mesh.mtl.tex_full_path, false, texw, texh);
-				if (bits) {
-					SoftSurfaceU32F3Ptr surface = std::make_shared<SoftSurfaceU32F3>();
-					surface->reset(texw, texh, (uint32_t*)bits, Swap02);
-					ResFree(bits);
-					cmd.uniforms.texture = CreateSoftMipmap(surface);
-				}
+				cmd.uniforms.texture = LoadSoftMipmap(mesh.mtl.tex_full_path, false);
 
 				cmd.uniforms.ambient = mesh.mtl.ambient;
 				cmd.uniforms.diffuse = mesh.mtl.diffuse;
@@ -2,8 +2,11 @@
 //
 
 #include "SoftRenderer\SoftPhongShading.h"
+#include "SoftRenderer\SoftTextureStreamer.h"
 #include "Core\Application.h"
 #include "ResourceParser\TextureLoader.h"
+#include "ResourceParser\TextureCache.h"
+#include "ResourceParser\MipChain.h"
 #include "PlatformSpec\WinViewer.h"
 #include "ResourceParser\ObjParser.h"
 
@@ -67,6 +70,21 @@ namespace soft_sponza {
 	};
 
 	typedef shakuras::SoftDrawCall<UniformList, SoftPhongAttribList, SoftPhongVaryingList> DrawCall;
+}
+
+
+SHAKURAS_BEGIN;
+
+template<>
+struct SoftClusterCullTraits<soft_sponza::UniformList> {
+	static const bool enabled = true;
+	static Matrix44f mvp(const soft_sponza::UniformList& u) { return u.mvp_trsf; }
+};
+
+SHAKURAS_END;
+
+
+namespace soft_sponza {
 
 	class AppStage {
 	public:
@@ -74,19 +92,54 @@ namespace soft_sponza {
 			float w = (float)viewer->width();
 			float h = (float)viewer->height();
 
-			std::vector<ObjMesh> meshs;
-			LoadObjMesh("Sponza/sponza.obj", meshs, false);
+			ObjModelView model;
+			LoadObjModelView("Sponza/sponza.obj", model, false);
+			acmr_ = std::to_string(model.acmr_before) + " -> " + std::to_string(model.acmr_after);
+
+			//grey until the coarse levels arrive
+			streamer_ = std::make_shared<SoftTextureStreamerU32F3>(kBlockBC1, 0xff808080);
+
+			//one streamed mipmap per file, shared by the materials using it
+			SoftTextureStreamerU32F3Ptr streamer = streamer_;
+			texcache_ = std::make_shared<TextureCache<SoftMipmapU32F3> >([streamer](const std::string& tex_path) -> SoftMipmapU32F3Ptr {
+				//a chain cached by an earlier run is mapped and resident at once
+				SoftMipmapU32F3Ptr cached = MapSoftMipmap<ColorFormatU32F3>(tex_path, false, kBlockBC1);
+				if (cached) {
+					return cached;
+				}
+
+				int texw = 0, texh = 0;
+				if (!TextureInfo(tex_path, false, texw, texh)) {
+					return nullptr;
+				}
+
+				//decoded straight into the mipmap, a file that changed size since TextureInfo is rejected
+				return streamer->request(texw, texh, [tex_path](uint32_t* level0, int w, int h) {
+					int decw = 0, dech = 0;
+					return LoadTexture(tex_path, false, decw, dech, kTextureBGRA8, [=](int lw, int lh) -> void* {
+						return (lw == w && lh == h ? level0 : nullptr);
+					}) != nullptr;
+				}, [tex_path](const SoftMipmapU32F3& mipmap) {
+					StoreSoftMipmap(tex_path, false, mipmap);
+				});
+			});
+
+			for (size_t i = 0; i != model.subsets.size(); i++) {
+				if (!model.subsets[i].mtl.tex_full_path.empty()) {
+					texcache_->request(model.subsets[i].mtl.tex_full_path, false);
+				}
+			}
 
 			outputs_.clear();
-			outputs_.resize(meshs.size());
+			outputs_.resize(model.subsets.size());
 
-			for (size_t i = 0; i != meshs.size(); i++) {
-				const ObjMesh& mesh = meshs[i];
+			for (size_t i = 0; i != model.subsets.size(); i++) {
+				const ObjSubset& mesh = model.subsets[i];
 				DrawCall& cmd = outputs_[i];
 
-				cmd.prims.verts_.resize(mesh.verts.size());
-				for (size_t ii = 0; ii != mesh.verts.size(); ii++) {
-					const ObjVert& objv = mesh.verts[ii];
+				cmd.prims.verts_.resize(mesh.vert_count);
+				for (size_t ii = 0; ii != mesh.vert_count; ii++) {
+					const ObjVert& objv = model.verts[mesh.vert_start + ii];
 					SoftPhongVertex& v = cmd.prims.verts_[ii];
 
 					v.pos.set(objv.pos.x, objv.pos.y, objv.pos.z, 1.0f);
@@ -94,16 +147,15 @@ namespace soft_sponza {
 					v.attribs.normal = objv.normal;
 				}
 
-				cmd.prims.indexs_ = mesh.tris;
+				cmd.prims.streamPositions();
+				cmd.prims.indexs_.assign(model.indices + mesh.index_start, model.indices + mesh.index_start + mesh.index_count);
+				BuildClusters(cmd.prims);
 
 				proj_ = Matrix44f::Perspective(kGSPI * 0.5f, w / h, 5.0f, 1000.0f);//ͶӰ任
 
-				SoftSurfaceU32F3Ptr surface = std::make_shared<SoftSurfaceU32F3>();
-				int texw = 0, texh = 0;
-				void* bits = LoadTexture(mesh.mtl.tex_full_path, false, texw, texh);
-				surface->reset(texw, texh, (uint32_t*)bits, Swap02);
-				ResFree(bits);
-				cmd.uniforms.texture = CreateSoftMipmap(surface);
+				if (!mesh.mtl.tex_full_path.empty()) {
+					cmd.uniforms.texture = texcache_->get(mesh.mtl.tex_full_path, false);
+				}
 
 				cmd.uniforms.ambient = mesh.mtl.ambient;
 				cmd.uniforms.diffuse = mesh.mtl.diffuse;
@@ -145,14 +197,25 @@ namespace soft_sponza {
 			cmds = outputs_;
 		}
 
+		int pendingTextures() const {
+			return streamer_ ? streamer_->pending() : 0;
+		}
+
+		const std::string& acmr() const {
+			return acmr_;
+		}
+
 	private:
 		WinMemViewerPtr viewer_;
+		SoftTextureStreamerU32F3Ptr streamer_;
+		std::shared_ptr<TextureCache<SoftMipmapU32F3> > texcache_;
 		Matrix44f proj_;
 		std::vector<DrawCall> outputs_;
+		std::string acmr_;
 		int step_, move_;
 	};
 
-	typedef shakuras::SoftRenderStage<UniformList, SoftPhongAttribList, SoftPhongVaryingList, ColorFormatU32F3, VertexShader, FragmentShader> RenderStage;
+	typedef shakuras::SoftRenderStage<UniformList, SoftPhongAttribList, SoftPhongVaryingList, ColorFormatU32F3, DepthFormatU24S8, VertexShader, FragmentShader> RenderStage;
 
 	typedef shakuras::Application<DrawCall, AppStage, RenderStage> Application;
 }
@@ -172,10 +235,12 @@ int main()
 	soft_sponza::Application app;
 	app.initialize(viewer);
 	app.renstage_.geostage_.refuseBack(false);
+	app.profiler_.addition("ACMR", app.appstage_.acmr());
 
 	while (!viewer->testUserMessage(kUMEsc) && !viewer->testUserMessage(kUMClose)) {
 		viewer->dispatch();
 
+		app.profiler_.addition("Streaming", std::to_string(app.appstage_.pendingTextures()));
 		app.process();
 
 		viewer->update();
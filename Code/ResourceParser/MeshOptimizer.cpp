@@ -0,0 +1,312 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <ppl.h>
+
+
+using namespace shakuras;
+
+
+const uint32_t kNoVertex = ~0u;
+
+
+//vertex v is in a FIFO of cache_size entries if it went in within the last cache_size insertions
+//moving timestamp past cache_size flushes the whole cache at once
+class FifoCache {
+public:
+	FifoCache(size_t vert_count, int cache_size) : time_(vert_count, 0), size_((uint32_t)cache_size), timestamp_((uint32_t)cache_size + 1) {}
+
+	inline bool hit(uint32_t v) const { return timestamp_ - time_[v] <= size_; }
+	inline uint32_t age(uint32_t v) const { return timestamp_ - time_[v]; }
+
+	//true on a miss
+	inline bool touch(uint32_t v) {
+		if (hit(v)) {
+			return false;
+		}
+		time_[v] = timestamp_++;
+		return true;
+	}
+
+	inline void flush() { timestamp_ += size_ + 1; }
+
+private:
+	std::vector<uint32_t> time_;
+	uint32_t size_;
+	uint32_t timestamp_;
+};
+
+
+size_t CountCacheMisses(const uint32_t* indices, size_t index_count, size_t vert_count, int cache_size) {
+	FifoCache cache(vert_count, cache_size);
+	size_t misses = 0;
+	for (size_t i = 0; i != index_count / 3 * 3; i++) {
+		misses += (cache.touch(indices[i]) ? 1 : 0);
+	}
+	return misses;
+}
+
+
+float ComputeACMR(const uint32_t* indices, size_t index_count, size_t vert_count, int cache_size) {
+	size_t tri_count = index_count / 3;
+	if (tri_count == 0) {
+		return 0.0f;
+	}
+
+	return (float)CountCacheMisses(indices, index_count, vert_count, cache_size) / tri_count;
+}
+
+
+//Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+void OptimizeVertexCache(uint32_t* indices, size_t index_count, size_t vert_count, int cache_size, std::vector<uint32_t>* clusters) {
+	size_t tri_count = index_count / 3;
+	if (clusters) {
+		clusters->clear();
+	}
+	if (tri_count == 0) {
+		return;
+	}
+
+	//triangles around every vertex
+	std::vector<uint32_t> adj_start(vert_count + 1, 0);
+	for (size_t i = 0; i != tri_count * 3; i++) {
+		adj_start[indices[i] + 1]++;
+	}
+	for (size_t v = 0; v != vert_count; v++) {
+		adj_start[v + 1] += adj_start[v];
+	}
+
+	std::vector<uint32_t> adj(tri_count * 3);
+	std::vector<uint32_t> cursor(adj_start.begin(), adj_start.end() - 1);
+	for (size_t i = 0; i != tri_count * 3; i++) {
+		adj[cursor[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	//triangles not emitted yet
+	std::vector<uint32_t> live(vert_count);
+	for (size_t v = 0; v != vert_count; v++) {
+		live[v] = adj_start[v + 1] - adj_start[v];
+	}
+
+	std::vector<uint8_t> emitted(tri_count, 0);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	dead_end.reserve(tri_count * 3);
+	output.reserve(tri_count * 3);
+	FifoCache cache(vert_count, cache_size);
+	size_t next_input = 0;
+
+	//most recently used vertex with triangles left, else the next one in input order
+	auto skip_dead_end = [&]() -> uint32_t {
+		while (!dead_end.empty()) {
+			uint32_t v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0) {
+				return v;
+			}
+		}
+		for (; next_input < vert_count; next_input++) {
+			if (live[next_input] > 0) {
+				return (uint32_t)next_input;
+			}
+		}
+		return kNoVertex;
+	};
+
+	uint32_t fan = skip_dead_end();
+	if (clusters) {
+		clusters->push_back(0);
+	}
+
+	while (fan != kNoVertex) {
+		candidates.clear();
+		for (uint32_t a = adj_start[fan]; a != adj_start[fan + 1]; a++) {
+			uint32_t t = adj[a];
+			if (emitted[t]) {
+				continue;
+			}
+			emitted[t] = 1;
+
+			for (int k = 0; k != 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				cache.touch(v);
+			}
+		}
+
+		//the neighbour that will still be cached after its own fan is emitted, the oldest one first
+		uint32_t best = kNoVertex;
+		int best_priority = -1;
+		for (auto i = candidates.begin(); i != candidates.end(); i++) {
+			if (live[*i] == 0) {
+				continue;
+			}
+
+			int priority = 0;
+			if (cache.age(*i) + 2 * live[*i] <= (uint32_t)cache_size) {
+				priority = (int)cache.age(*i);
+			}
+			if (priority > best_priority) {
+				best = *i;
+				best_priority = priority;
+			}
+		}
+
+		if (best == kNoVertex) {
+			best = skip_dead_end();
+			if (clusters && best != kNoVertex) {
+				clusters->push_back((uint32_t)(output.size() / 3));
+			}
+		}
+		fan = best;
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+
+void OptimizeOverdraw(uint32_t* indices, size_t index_count, const ObjVert* verts, size_t vert_count, const std::vector<uint32_t>& clusters, float threshold, int cache_size) {
+	size_t tri_count = index_count / 3;
+	if (tri_count == 0 || clusters.empty()) {
+		return;
+	}
+
+	//a cluster is cut wherever the part before is already about as cache friendly as the whole
+	FifoCache cache(vert_count, cache_size);
+	auto tri_misses = [&](size_t t) {
+		int misses = 0;
+		for (int k = 0; k != 3; k++) {
+			misses += (cache.touch(indices[t * 3 + k]) ? 1 : 0);
+		}
+		return misses;
+	};
+
+	std::vector<uint32_t> soft;
+	for (size_t c = 0; c != clusters.size(); c++) {
+		size_t begin = clusters[c];
+		size_t end = (c + 1 != clusters.size() ? clusters[c + 1] : tri_count);
+
+		cache.flush();
+		size_t total = 0;
+		for (size_t t = begin; t != end; t++) {
+			total += tri_misses(t);
+		}
+		float target = threshold * total / (end - begin);
+
+		cache.flush();
+		size_t start = begin;
+		size_t misses = 0;
+		soft.push_back((uint32_t)start);
+		for (size_t t = begin; t + 1 < end; t++) {
+			misses += tri_misses(t);
+			if (misses <= target * (t + 1 - start)) {
+				start = t + 1;
+				misses = 0;
+				soft.push_back((uint32_t)start);
+				cache.flush();
+			}
+		}
+	}
+
+	Vector3f mesh_center;
+	for (size_t i = 0; i != tri_count * 3; i++) {
+		mesh_center = mesh_center + verts[indices[i]].pos;
+	}
+	mesh_center = mesh_center / (float)(tri_count * 3);
+
+	//clusters facing away from the center are in front from most view points
+	std::vector<std::pair<float, uint32_t> > order(soft.size());
+	for (size_t c = 0; c != soft.size(); c++) {
+		size_t begin = soft[c];
+		size_t end = (c + 1 != soft.size() ? soft[c + 1] : tri_count);
+
+		Vector3f center, normal;
+		for (size_t t = begin; t != end; t++) {
+			const Vector3f& p0 = verts[indices[t * 3 + 0]].pos;
+			const Vector3f& p1 = verts[indices[t * 3 + 1]].pos;
+			const Vector3f& p2 = verts[indices[t * 3 + 2]].pos;
+			center = center + p0 + p1 + p2;
+			normal = normal + CrossProduct3(p1 - p0, p2 - p0);//area weighted
+		}
+		center = center / (float)((end - begin) * 3);
+
+		float len = Length3(normal);
+		order[c].first = (len > 0.0f ? DotProduct3(center - mesh_center, normal) / len : 0.0f);
+		order[c].second = (uint32_t)c;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) {
+		return a.first > b.first;
+	});
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(tri_count * 3);
+	for (auto i = order.begin(); i != order.end(); i++) {
+		size_t begin = soft[i->second];
+		size_t end = (i->second + 1 != soft.size() ? soft[i->second + 1] : tri_count);
+		sorted.insert(sorted.end(), indices + begin * 3, indices + end * 3);
+	}
+
+	std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+
+void OptimizeVertexFetch(uint32_t* indices, size_t index_count, ObjVert* verts, size_t vert_count) {
+	std::vector<uint32_t> remap(vert_count, kNoVertex);
+	uint32_t next = 0;
+	for (size_t i = 0; i != index_count; i++) {
+		if (remap[indices[i]] == kNoVertex) {
+			remap[indices[i]] = next++;
+		}
+		indices[i] = remap[indices[i]];
+	}
+
+	for (size_t v = 0; v != vert_count; v++) {
+		if (remap[v] == kNoVertex) {
+			remap[v] = next++;
+		}
+	}
+
+	std::vector<ObjVert> reordered(vert_count);
+	for (size_t v = 0; v != vert_count; v++) {
+		reordered[remap[v]] = verts[v];
+	}
+	std::copy(reordered.begin(), reordered.end(), verts);
+}
+
+
+void OptimizeObjModel(ObjModel& model, bool overdraw) {
+	std::vector<size_t> misses_before(model.subsets.size(), 0);
+	std::vector<size_t> misses_after(model.subsets.size(), 0);
+
+	//subsets own disjoint vertex and index ranges
+	Concurrency::parallel_for((size_t)0, model.subsets.size(), [&](size_t i) {
+		const ObjSubset& subset = model.subsets[i];
+		uint32_t* indices = model.indices.data() + subset.index_start;
+		ObjVert* verts = model.verts.data() + subset.vert_start;
+
+		misses_before[i] = CountCacheMisses(indices, subset.index_count, subset.vert_count, kVertexCacheSize);
+
+		std::vector<uint32_t> clusters;
+		OptimizeVertexCache(indices, subset.index_count, subset.vert_count, kVertexCacheSize, &clusters);
+		if (overdraw) {
+			OptimizeOverdraw(indices, subset.index_count, verts, subset.vert_count, clusters);
+		}
+		OptimizeVertexFetch(indices, subset.index_count, verts, subset.vert_count);
+
+		misses_after[i] = CountCacheMisses(indices, subset.index_count, subset.vert_count, kVertexCacheSize);
+	});
+
+	size_t tri_count = 0, before = 0, after = 0;
+	for (size_t i = 0; i != model.subsets.size(); i++) {
+		tri_count += model.subsets[i].index_count / 3;
+		before += misses_before[i];
+		after += misses_after[i];
+	}
+
+	model.acmr_before = (tri_count != 0 ? (float)before / tri_count : 0.0f);
+	model.acmr_after = (tri_count != 0 ? (float)after / tri_count : 0.0f);
+}
\ No newline at end of file
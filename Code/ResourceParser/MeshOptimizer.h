@@ -0,0 +1,25 @@
+#pragma once
+#include "ObjParser.h"
+#include <vector>
+
+
+//post-transform vertex cache the orderings are tuned for and ACMR is measured with
+const int kVertexCacheSize = 16;
+
+
+//average cache misses per triangle of a FIFO cache, 0.5 at best for a regular grid, 3 at worst
+RESPARSER_DLL float ComputeACMR(const uint32_t* indices, size_t index_count, size_t vert_count, int cache_size = kVertexCacheSize);
+
+//Tipsify, reorders the triangles in place
+//clusters receives the first triangle of every run that had to restart on a cold cache
+RESPARSER_DLL void OptimizeVertexCache(uint32_t* indices, size_t index_count, size_t vert_count, int cache_size = kVertexCacheSize, std::vector<uint32_t>* clusters = nullptr);
+
+//splits the clusters of OptimizeVertexCache further as long as the ACMR stays within threshold,
+//then draws the outward facing ones first so they occlude the rest from most view points
+RESPARSER_DLL void OptimizeOverdraw(uint32_t* indices, size_t index_count, const ObjVert* verts, size_t vert_count, const std::vector<uint32_t>& clusters, float threshold = 1.05f, int cache_size = kVertexCacheSize);
+
+//renumbers the vertices in order of first use, unused ones go last
+RESPARSER_DLL void OptimizeVertexFetch(uint32_t* indices, size_t index_count, ObjVert* verts, size_t vert_count);
+
+//all of the above on every subset, records the model's ACMR before and after
+RESPARSER_DLL void OptimizeObjModel(ObjModel& model, bool overdraw = true);
\ No newline at end of file
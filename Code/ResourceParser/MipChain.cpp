@@ -0,0 +1,104 @@
+#include "MipChain.h"
+#include <fstream>
+#include <filesystem>
+#include <string.h>
+
+
+//bump the version whenever SoftMipmap's layout, its downsampling or the block encoders change
+const char kMipChainMagic[8] = { 'S', 'K', 'R', 'M', 'I', 'P', 'S', '\0' };
+const uint32_t kMipChainVersion = 1;
+
+//the payload starts on its own cache line, mapped views are page aligned
+const uint64_t kMipChainDataOffset = 64;
+
+struct MipChainHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t texel_bytes;
+	uint32_t block;
+	int32_t width, height;
+	uint32_t reserved;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t data_offset, data_size;
+};
+
+static_assert(sizeof(MipChainHeader) <= kMipChainDataOffset, "the header fits before the payload");
+
+
+bool MipChainSource(std::string& filepath, bool isrelpath, MipChainHeader& header) {
+	if (isrelpath) {
+		filepath = _FSPFX absolute(filepath, ResourceDir()).string();
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMipChainMagic, sizeof(kMipChainMagic));
+	header.version = kMipChainVersion;
+	return FileStamp(filepath, header.source_size, header.source_mtime);
+}
+
+
+std::shared_ptr<MappedFile> MapMipChain(std::string filepath, bool isrelpath, MipChainDesc& desc, const void*& bits, size_t& size) {
+	MipChainHeader expected;
+	if (!MipChainSource(filepath, isrelpath, expected)) {
+		return nullptr;
+	}
+
+	std::shared_ptr<MappedFile> cachef = std::make_shared<MappedFile>();
+	if (!cachef->open(filepath + ".mips") || cachef->size() < kMipChainDataOffset) {
+		return nullptr;
+	}
+
+	const MipChainHeader& header = *(const MipChainHeader*)cachef->data();
+	if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+		|| header.version != expected.version
+		|| header.source_size != expected.source_size
+		|| header.source_mtime != expected.source_mtime
+		|| header.texel_bytes != desc.texel_bytes
+		|| header.block != desc.block
+		|| header.width <= 0 || header.height <= 0
+		|| header.data_offset != kMipChainDataOffset
+		|| header.data_offset + header.data_size != cachef->size()) {
+		return nullptr;
+	}
+
+	desc.width = header.width;
+	desc.height = header.height;
+	bits = cachef->data() + header.data_offset;
+	size = (size_t)header.data_size;
+	return cachef;
+}
+
+
+bool WriteMipChain(std::string filepath, bool isrelpath, const MipChainDesc& desc, const void* bits, size_t size) {
+	MipChainHeader header;
+	if (!bits || size == 0 || !MipChainSource(filepath, isrelpath, header)) {
+		return false;
+	}
+
+	header.texel_bytes = desc.texel_bytes;
+	header.block = desc.block;
+	header.width = desc.width;
+	header.height = desc.height;
+	header.data_offset = kMipChainDataOffset;
+	header.data_size = size;
+
+	//written aside and moved into place like the OBJ cache, a reader never sees a torn chain
+	std::string cache_fname = filepath + ".mips";
+	std::string temp_fname = cache_fname + ".tmp";
+	std::ofstream cachef(temp_fname, std::ios::binary | std::ios::trunc);
+	if (!cachef) return false;
+
+	char head[kMipChainDataOffset] = {};
+	memcpy(head, &header, sizeof(header));
+	cachef.write(head, sizeof(head));
+	cachef.write((const char*)bits, (std::streamsize)size);
+
+	cachef.close();
+	if (cachef.fail()) {
+		std::error_code ec;
+		_FSPFX remove(temp_fname, ec);
+		return false;
+	}
+	return CommitTempFile(temp_fname, cache_fname);
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+#include "ResUtility.h"
+#include "TextureLoader.h"
+#include "SoftRenderer/SoftMipmap.h"
+#include "SoftRenderer/SoftSurface.h"
+#include <memory>
+
+
+//precomputed mip chain next to the image, "<image>.mips", written the first time the image is built
+//the payload is SoftMipmap's own storage, loading it is a mapping plus a pointer fix-up
+struct MipChainDesc {
+	int width, height;//level 0
+	uint32_t texel_bytes;//uncompressed texel size
+	uint32_t block;//SoftBlockFormat of the levels
+};
+
+//maps the chain if it was built from the current image with the same texel size and block format
+//width/height are filled in, bits stays valid as long as the returned file
+RESPARSER_DLL std::shared_ptr<MappedFile> MapMipChain(std::string filepath, bool isrelpath, MipChainDesc& desc, const void*& bits, size_t& size);
+RESPARSER_DLL bool WriteMipChain(std::string filepath, bool isrelpath, const MipChainDesc& desc, const void* bits, size_t size);
+
+
+template<class CF>
+std::shared_ptr<shakuras::SoftMipmap<CF> > MapSoftMipmap(std::string filepath, bool isrelpath, int block = shakuras::kBlockNone) {
+	MipChainDesc desc = { 0, 0, sizeof(typename CF::data_t), (uint32_t)block };
+	const void* bits = nullptr;
+	size_t size = 0;
+	std::shared_ptr<MappedFile> file = MapMipChain(filepath, isrelpath, desc, bits, size);
+	if (!file) {
+		return nullptr;
+	}
+
+	return shakuras::CreateSoftMipmap<CF>(bits, size, desc.width, desc.height, block, file);
+}
+
+template<class CF>
+bool StoreSoftMipmap(std::string filepath, bool isrelpath, const shakuras::SoftMipmap<CF>& mipmap) {
+	if (!mipmap.resident() || !mipmap.storage()) {
+		return false;
+	}
+
+	MipChainDesc desc = { mipmap.width(), mipmap.height(), sizeof(typename CF::data_t), (uint32_t)mipmap.block() };
+	return WriteMipChain(filepath, isrelpath, desc, mipmap.storage(), mipmap.storageSize());
+}
+
+//mapped when the cache is up to date, otherwise decoded, built and cached for the next run
+inline shakuras::SoftMipmapU32F3Ptr LoadSoftMipmap(std::string filepath, bool isrelpath, int block = shakuras::kBlockNone) {
+	shakuras::SoftMipmapU32F3Ptr mipmap = MapSoftMipmap<shakuras::ColorFormatU32F3>(filepath, isrelpath, block);
+	if (mipmap) {
+		return mipmap;
+	}
+
+	shakuras::SoftSurfaceU32F3Ptr surface = std::make_shared<shakuras::SoftSurfaceU32F3>();
+	int texw = 0, texh = 0;
+	void* bits = LoadTexture(filepath, isrelpath, texw, texh, kTextureBGRA8, [&](int w, int h) {
+		surface->reset(w, h);
+		return surface->buffer();
+	});
+	if (!bits) {
+		return nullptr;
+	}
+
+	mipmap = shakuras::CreateSoftMipmap(surface, block);
+	StoreSoftMipmap(filepath, isrelpath, *mipmap);
+	return mipmap;
+}
\ No newline at end of file
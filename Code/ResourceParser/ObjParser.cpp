@@ -1,9 +1,13 @@
 #include "ObjParser.h"
+#include "MeshOptimizer.h"
 #include <array>
-#include <map>
 #include <fstream>
 #include <algorithm>
 #include <filesystem>
+#include <thread>
+#include <string.h>
+#include <stdlib.h>
+#include <ppl.h>
 #include "ResUtility.h"
 
 
@@ -89,160 +93,849 @@ bool LoadObjMtl(std::vector<ObjMtl>& mtls, const std::string& mtl_file, _FSPFX p
 }
 
 
-bool LoadObj(std::string fname, std::vector<ObjVert>& verts, std::vector<uint32_t>& indices, std::vector<uint32_t>& attrs, std::vector<ObjMtl>& mtls, bool flip_tex_v) {
-	fname = _FSPFX absolute(fname, ResourceDir()).string();
+//number parsing straight on the mapped text, MSVC14 has no std::from_chars
+inline bool IsBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+inline bool ParseUInt(const char*& p, const char* end, uint32_t& v) {
+	while (p != end && IsBlank(*p)) ++p;
+
+	const char* q = p;
+	uint32_t r = 0;
+	while (q != end && *q >= '0' && *q <= '9') {
+		r = r * 10 + (uint32_t)(*q - '0');
+		++q;
+	}
+
+	if (q == p) return false;
+
+	v = r;
+	p = q;
+	return true;
+}
+
+
+inline bool ParseFloat(const char*& p, const char* end, float& v) {
+	static const double kPow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	while (p != end && IsBlank(*p)) ++p;
+
+	const char* q = p;
+	bool neg = false;
+	if (q != end && (*q == '-' || *q == '+')) {
+		neg = (*q == '-');
+		++q;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0, exp10 = 0;
+	bool any = false;
+	for (; q != end && *q >= '0' && *q <= '9'; ++q, any = true) {
+		if (mantissa != 0 || *q != '0') {
+			if (digits < 19) mantissa = mantissa * 10 + (uint64_t)(*q - '0');
+			else exp10++;
+			digits++;
+		}
+	}
+	if (q != end && *q == '.') {
+		for (++q; q != end && *q >= '0' && *q <= '9'; ++q, any = true) {
+			if (mantissa != 0 || *q != '0') {
+				if (digits < 19) {
+					mantissa = mantissa * 10 + (uint64_t)(*q - '0');
+					exp10--;
+				}
+				digits++;
+			}
+			else {
+				exp10--;
+			}
+		}
+	}
+	if (any && q != end && (*q == 'e' || *q == 'E')) {
+		const char* e = q + 1;
+		bool eneg = false;
+		if (e != end && (*e == '-' || *e == '+')) {
+			eneg = (*e == '-');
+			++e;
+		}
+		if (e != end && *e >= '0' && *e <= '9') {
+			int ev = 0;
+			for (; e != end && *e >= '0' && *e <= '9'; ++e) {
+				if (ev < 10000) ev = ev * 10 + (*e - '0');
+			}
+			exp10 += (eneg ? -ev : ev);
+			q = e;
+		}
+	}
+
+	//exact in double, one correctly rounded scaling
+	if (any && digits <= 15 && exp10 >= -22 && exp10 <= 22) {
+		double d = (double)mantissa;
+		d = (exp10 < 0 ? d / kPow10[-exp10] : d * kPow10[exp10]);
+		v = (float)(neg ? -d : d);
+		p = q;
+		return true;
+	}
+
+	//long mantissas, huge exponents, inf and nan
+	char buf[64];
+	size_t n = 0;
+	for (const char* t = p; t != end && !IsBlank(*t) && *t != '\n' && *t != '/' && n + 1 < sizeof(buf); ++t) {
+		buf[n++] = *t;
+	}
+	buf[n] = 0;
+
+	char* stop = nullptr;
+	double d = strtod(buf, &stop);
+	if (stop == buf) return false;
+
+	v = (float)d;
+	p += (stop - buf);
+	return true;
+}
+
+
+typedef std::array<uint32_t, 3> smooth_id_t;
+
+
+//open addressing with linear probing, keys are never removed
+class SmoothIdTable {
+public:
+	explicit SmoothIdTable(size_t expected) : size_(0) {
+		size_t capacity = 16;
+		while (capacity < expected * 2) capacity <<= 1;
+		slots_.resize(capacity);
+	}
+
+	//the value already stored for key, or value after storing it
+	uint32_t insert(const smooth_id_t& key, uint32_t value) {
+		if ((size_ + 1) * 2 > slots_.size()) {
+			grow();
+		}
+
+		size_t mask = slots_.size() - 1;
+		for (size_t i = (size_t)Hash(key) & mask;; i = (i + 1) & mask) {
+			Slot& slot = slots_[i];
+			if (slot.value == kEmpty) {
+				slot.key = key;
+				slot.value = value;
+				size_++;
+				return value;
+			}
+			if (slot.key == key) {
+				return slot.value;
+			}
+		}
+	}
+
+	static uint64_t Hash(const smooth_id_t& key) {
+		uint64_t h = ((uint64_t)key[0] << 32 | key[1]) * 0x9E3779B97F4A7C15ull ^ (uint64_t)key[2] * 0xC2B2AE3D27D4EB4Full;
+		h ^= h >> 29;
+		h *= 0xBF58476D1CE4E5B9ull;
+		h ^= h >> 32;
+		return h;
+	}
+
+private:
+	static const uint32_t kEmpty = 0xffffffff;
+
+	struct Slot {
+		Slot() : value(kEmpty) {}
+		smooth_id_t key;
+		uint32_t value;
+	};
+
+	void grow() {
+		std::vector<Slot> old(slots_.size() * 2);
+		old.swap(slots_);
+		size_ = 0;
+		for (auto i = old.begin(); i != old.end(); i++) {
+			if (i->value != kEmpty) {
+				insert(i->key, i->value);
+			}
+		}
+	}
+
+private:
+	std::vector<Slot> slots_;
+	size_t size_;
+};
+
+
+//vertex id of every corner, ids follow the first occurrence of each smooth id in corner order
+//firsts receives that first corner of every vertex
+void DedupCorners(const std::vector<smooth_id_t>& corners, size_t expected, std::vector<uint32_t>& ids, std::vector<uint32_t>& firsts) {
+	const size_t kParallelCorners = 1 << 18;
+	const int kShardBits = 6;
+	const size_t kShards = 1 << kShardBits;
+
+	size_t n = corners.size();
+	ids.resize(n);
+	firsts.clear();
+	firsts.reserve(expected);
+
+	if (n < kParallelCorners || std::thread::hardware_concurrency() <= 1) {
+		SmoothIdTable table(expected);
+		for (size_t i = 0; i != n; i++) {
+			ids[i] = table.insert(corners[i], (uint32_t)firsts.size());
+			if (ids[i] == firsts.size()) {
+				firsts.push_back((uint32_t)i);
+			}
+		}
+		return;
+	}
+
+	//the top hash bits pick the shard, each shard finds the first corner of its keys
+	std::vector<uint8_t> shard(n);
+	Concurrency::parallel_for(size_t(0), n, size_t(1) << 14, [&](size_t b) {
+		size_t e = (std::min)(b + (size_t(1) << 14), n);
+		for (size_t i = b; i != e; i++) {
+			shard[i] = (uint8_t)(SmoothIdTable::Hash(corners[i]) >> (64 - kShardBits));
+		}
+	});
+
+	//corners bucketed by shard with a counting sort, in corner order within a bucket
+	std::vector<uint32_t> bucket_start(kShards + 1, 0);
+	for (size_t i = 0; i != n; i++) {
+		bucket_start[shard[i] + 1]++;
+	}
+	for (size_t s = 0; s != kShards; s++) {
+		bucket_start[s + 1] += bucket_start[s];
+	}
+
+	std::vector<uint32_t> bucket(n);
+	std::vector<uint32_t> cursor(bucket_start.begin(), bucket_start.end() - 1);
+	for (size_t i = 0; i != n; i++) {
+		bucket[cursor[shard[i]]++] = (uint32_t)i;
+	}
 
-	std::ifstream objf(fname);
+	std::vector<uint32_t> first(n);
+	Concurrency::parallel_for(size_t(0), kShards, [&](size_t s) {
+		SmoothIdTable table(expected / kShards + 1);
+		for (uint32_t k = bucket_start[s]; k != bucket_start[s + 1]; k++) {
+			uint32_t i = bucket[k];
+			first[i] = table.insert(corners[i], i);
+		}
+	});
 
-	if (!objf) return false;
+	//numbered in corner order, same as the serial path
+	for (size_t i = 0; i != n; i++) {
+		if (first[i] == i) {
+			ids[i] = (uint32_t)firsts.size();
+			firsts.push_back((uint32_t)i);
+		}
+		else {
+			ids[i] = ids[first[i]];
+		}
+	}
+}
 
-	std::string obj_cmd;
 
+//result of one line-aligned piece of the file
+struct ObjChunk {
 	std::vector<Vector3f> positions;
 	std::vector<Vector2f> uvs;
 	std::vector<Vector3f> normals;
+	std::vector<smooth_id_t> corners;//3 per face
+	std::vector<std::pair<size_t, std::string> > usemtls;//face index in the chunk, material name
+	std::string mtllib;
+};
 
-	ObjMtl mtl;
-	std::string mtl_fname;
 
-	// init_material
-	mtls.push_back(mtl);
+void ParseObjChunk(const char* p, const char* end, bool flip_tex_v, ObjChunk& chunk) {
+	while (p != end) {
+		while (p != end && (IsBlank(*p) || *p == '\n')) ++p;
 
-	uint32_t subset = 0;
-
-	typedef std::array<uint32_t, 3> smooth_id_t;
-	std::map<smooth_id_t, uint32_t> smooth_id_to_vertex_index;
+		const char* cmd = p;
+		while (p != end && !IsBlank(*p) && *p != '\n') ++p;
+		size_t cmd_len = p - cmd;
 
-	for (;;) {
-		objf >> obj_cmd;
-		if (!objf) { break; }
-		if (obj_cmd == "#") {
-			; // Comment
-		}
-		else if (obj_cmd == "v") {
+		if (cmd_len == 1 && cmd[0] == 'v') {
 			float x = 0.0f, y = 0.0f, z = 0.0f;
-			objf >> x >> y >> z;
-			positions.push_back(Vector3f(x, y, z));
+			ParseFloat(p, end, x);
+			ParseFloat(p, end, y);
+			ParseFloat(p, end, z);
+			chunk.positions.push_back(Vector3f(x, y, z));
 		}
-		else if (obj_cmd == "vt") {
+		else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 't') {
 			float u = 0.0f, v = 0.0f;
-			objf >> u >> v;
-			uvs.push_back(Vector2f(u, (flip_tex_v ? 1.0f - v : v)));
+			ParseFloat(p, end, u);
+			ParseFloat(p, end, v);
+			chunk.uvs.push_back(Vector2f(u, (flip_tex_v ? 1.0f - v : v)));
 		}
-		else if (obj_cmd == "vn") {
+		else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 'n') {
 			float x = 0.0f, y = 0.0f, z = 0.0f;
-			objf >> x >> y >> z;
-			normals.push_back(Vector3f(x, y, z));
+			ParseFloat(p, end, x);
+			ParseFloat(p, end, y);
+			ParseFloat(p, end, z);
+			chunk.normals.push_back(Vector3f(x, y, z));
 		}
-		else if (obj_cmd == "f") {
-
+		else if (cmd_len == 1 && cmd[0] == 'f') {
+			//uv/normal indices carry over to the next corner when omitted, as the stream parser did
 			uint32_t pos_index = 0, texcoord_index = 0, normal_index = 0;
+			smooth_id_t face[3];
+			bool ok = true;
 
-			for (uint32_t face_index = 0; face_index < 3; ++face_index) {
-				ObjVert vert;
+			for (uint32_t face_index = 0; ok && face_index < 3; ++face_index) {
+				ok = ParseUInt(p, end, pos_index);
 
-				objf >> pos_index;
-				vert.pos = positions[pos_index - 1];
+				if (ok && p != end && *p == '/') {
+					++p;
 
-				if (objf.peek() == '/') {
-					objf.ignore();
-
-					if (objf.peek() != '/') {
-						objf >> texcoord_index;
-						vert.uv = uvs[texcoord_index - 1];
+					if (p != end && *p != '/') {
+						ok = ParseUInt(p, end, texcoord_index);
 					}
 
-					if ('/' == objf.peek()) {
-						objf.ignore();
-						objf >> normal_index;
-						vert.normal = normals[normal_index - 1];
+					if (ok && p != end && *p == '/') {
+						++p;
+						ok = ParseUInt(p, end, normal_index);
 					}
 				}
 
-				uint32_t vert_index = 0;
 				smooth_id_t smooth_id = { pos_index, texcoord_index, normal_index };
-				if (smooth_id_to_vertex_index.count(smooth_id) == 0) {
-					vert_index = static_cast<uint32_t>(verts.size());
-					smooth_id_to_vertex_index[smooth_id] = vert_index;
-					verts.push_back(vert);
-				}
-				else {
-					vert_index = smooth_id_to_vertex_index[smooth_id];
-				}
-				indices.push_back(vert_index);
+				face[face_index] = smooth_id;
 			}
 
-			attrs.push_back(subset);
-		}
-		else if (obj_cmd == "mtllib") {
-			objf >> mtl_fname;
-		}
-		else if (obj_cmd == "usemtl") {
-			std::string name;
-			objf >> name;
-			bool found = false;
-			for (size_t mtl_index = 0; mtl_index < mtls.size(); ++mtl_index) {
-				ObjMtl* pmtl = &mtls[mtl_index];
-				if (pmtl->name == name) {
-					found = true;
-					subset = static_cast<uint32_t>(mtl_index);
-					break;
-				}
+			if (ok) {
+				chunk.corners.insert(chunk.corners.end(), face, face + 3);
 			}
+		}
+		else if (cmd_len == 6 && memcmp(cmd, "mtllib", 6) == 0) {
+			while (p != end && IsBlank(*p)) ++p;
+			const char* name = p;
+			while (p != end && !IsBlank(*p) && *p != '\n') ++p;
+			chunk.mtllib.assign(name, p);
+		}
+		else if (cmd_len == 6 && memcmp(cmd, "usemtl", 6) == 0) {
+			while (p != end && IsBlank(*p)) ++p;
+			const char* name = p;
+			while (p != end && !IsBlank(*p) && *p != '\n') ++p;
+			chunk.usemtls.push_back(std::make_pair(chunk.corners.size() / 3, std::string(name, p)));
+		}
+		else {
+			; // Comment or unrecognized command
+		}
+
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		p = (eol ? eol + 1 : end);
+	}
+}
+
+
+//mtl_fnames receives the material libraries read, as named in the file
+bool LoadObj(std::string fname, std::vector<ObjVert>& verts, std::vector<uint32_t>& indices, std::vector<uint32_t>& attrs, std::vector<ObjMtl>& mtls, std::vector<std::string>& mtl_fnames, bool flip_tex_v) {
+	fname = _FSPFX absolute(fname, ResourceDir()).string();
+
+	MappedFile objf;
+	if (!objf.open(fname)) return false;
 
-			if (!found) {
-				subset = static_cast<uint32_t>(mtls.size());
-				mtls.push_back(ObjMtl());
-				mtls.back().name = name;
+	//line-aligned chunks, parsed in parallel and stitched in file order
+	const size_t kMinChunkSize = 1 << 20;
+	size_t nchunk = objf.size() / kMinChunkSize;
+	nchunk = Clamp<size_t>(nchunk, 1, (std::max)(std::thread::hardware_concurrency(), 1u) * 4);
+
+	std::vector<const char*> bounds(nchunk + 1, objf.data());
+	bounds[nchunk] = objf.data() + objf.size();
+	for (size_t i = 1; i < nchunk; i++) {
+		const char* p = (std::max)(objf.data() + objf.size() * i / nchunk, bounds[i - 1]);
+		const char* eol = (const char*)memchr(p, '\n', bounds[nchunk] - p);
+		bounds[i] = (eol ? eol + 1 : bounds[nchunk]);
+	}
+
+	std::vector<ObjChunk> chunks(nchunk);
+	Concurrency::parallel_for(size_t(0), nchunk, [&](size_t i) {
+		ParseObjChunk(bounds[i], bounds[i + 1], flip_tex_v, chunks[i]);
+	});
+
+	std::vector<Vector3f> positions;
+	std::vector<Vector2f> uvs;
+	std::vector<Vector3f> normals;
+
+	std::string mtl_fname;
+	std::vector<smooth_id_t> corners;
+	size_t ncorner = 0;
+	for (auto i = chunks.begin(); i != chunks.end(); i++) {
+		ncorner += i->corners.size();
+	}
+	corners.reserve(ncorner);
+
+	for (auto i = chunks.begin(); i != chunks.end(); i++) {
+		positions.insert(positions.end(), i->positions.begin(), i->positions.end());
+		uvs.insert(uvs.end(), i->uvs.begin(), i->uvs.end());
+		normals.insert(normals.end(), i->normals.begin(), i->normals.end());
+		corners.insert(corners.end(), i->corners.begin(), i->corners.end());
+		if (!i->mtllib.empty()) {
+			mtl_fname = i->mtllib;
+		}
+	}
+
+	ObjMtl mtl;
+
+	// init_material
+	mtls.push_back(mtl);
+
+	uint32_t subset = 0;
+
+	auto use_mtl = [&](const std::string& name) {
+		bool found = false;
+		for (size_t mtl_index = 0; mtl_index < mtls.size(); ++mtl_index) {
+			ObjMtl* pmtl = &mtls[mtl_index];
+			if (pmtl->name == name) {
+				found = true;
+				subset = static_cast<uint32_t>(mtl_index);
+				break;
 			}
+		}
 
+		if (!found) {
+			subset = static_cast<uint32_t>(mtls.size());
+			mtls.push_back(ObjMtl());
+			mtls.back().name = name;
 		}
-		else {
-			; // Unrecognized command
+	};
+
+	attrs.reserve(attrs.size() + ncorner / 3);
+	for (auto i = chunks.begin(); i != chunks.end(); i++) {
+		auto ev = i->usemtls.begin();
+
+		for (size_t face = 0; face * 3 < i->corners.size(); ++face) {
+			for (; ev != i->usemtls.end() && ev->first == face; ++ev) {
+				use_mtl(ev->second);
+			}
+			attrs.push_back(subset);
+		}
+
+		//trailing usemtl applies to the next chunk
+		for (; ev != i->usemtls.end(); ++ev) {
+			use_mtl(ev->second);
 		}
+	}
+	chunks.clear();
+
+	//most meshes have fewer vertices than faces
+	std::vector<uint32_t> ids, firsts;
+	DedupCorners(corners, ncorner / 3, ids, firsts);
 
-		objf.ignore(1000, '\n');
+	uint32_t base = static_cast<uint32_t>(verts.size());
+	indices.reserve(indices.size() + ncorner);
+	for (size_t i = 0; i != ncorner; i++) {
+		indices.push_back(base + ids[i]);
 	}
 
+	verts.resize(base + firsts.size());
+	Concurrency::parallel_for(size_t(0), firsts.size(), [&](size_t i) {
+		const smooth_id_t& smooth_id = corners[firsts[i]];
+
+		ObjVert& vert = verts[base + i];
+		if (smooth_id[0] - 1 < positions.size()) vert.pos = positions[smooth_id[0] - 1];
+		if (smooth_id[1] - 1 < uvs.size()) vert.uv = uvs[smooth_id[1] - 1];
+		if (smooth_id[2] - 1 < normals.size()) vert.normal = normals[smooth_id[2] - 1];
+	});
+
 	objf.close();
 
 	_FSPFX path abspath = _FSPFX absolute(_FSPFX path(fname));
 	if (!mtl_fname.empty()) {
 		LoadObjMtl(mtls, mtl_fname, abspath.parent_path());
+		mtl_fnames.push_back(mtl_fname);
 	}
 	return true;
 }
 
 
 
-bool LoadObjMesh(const std::string& fname, std::vector<ObjMesh>& meshs, bool flip_tex_v) {
+bool ParseObjModel(const std::string& fname, ObjModel& model, std::vector<std::string>& mtl_fnames, bool flip_tex_v) {
 	std::vector<ObjVert> verts;
 	std::vector<uint32_t> indices;
 	std::vector<uint32_t> attrs;
 	std::vector<ObjMtl> mtls;
 
-	if (!LoadObj(fname, verts, indices, attrs, mtls, flip_tex_v)) {
+	if (!LoadObj(fname, verts, indices, attrs, mtls, mtl_fnames, flip_tex_v)) {
 		return false;
 	}
 
+	model.verts.clear();
+	model.indices.clear();
+	model.subsets.clear();
+
+	//counting sort of the faces by material
+	std::vector<uint32_t> face_start(mtls.size() + 1, 0);
+	for (size_t i_face = 0; i_face < attrs.size(); ++i_face) {
+		face_start[attrs[i_face] + 1]++;
+	}
 	for (size_t i_mtl = 0; i_mtl < mtls.size(); ++i_mtl) {
-		ObjMesh mesh;
+		face_start[i_mtl + 1] += face_start[i_mtl];
+	}
+
+	std::vector<uint32_t> sorted(indices.size());
+	std::vector<uint32_t> cursor(face_start.begin(), face_start.end() - 1);
+	for (size_t i_face = 0; i_face < attrs.size(); ++i_face) {
+		uint32_t dst = cursor[attrs[i_face]]++;
+		std::copy_n(&indices[i_face * 3], 3, &sorted[dst * 3]);
+	}
 
-		// Fill data
-		mesh.verts = verts;
-		mesh.mtl = mtls[i_mtl];
+	//each subset copies the vertices it uses, in order of first use
+	const uint32_t kNoOwner = 0xffffffff;
+	std::vector<uint32_t> owner(verts.size(), kNoOwner);
+	std::vector<uint32_t> remap(verts.size());
+
+	model.indices.reserve(sorted.size());
+	for (uint32_t i_mtl = 0; i_mtl < (uint32_t)mtls.size(); ++i_mtl) {
+		if (face_start[i_mtl] == face_start[i_mtl + 1]) {
+			continue;
+		}
 
-		// Construct vertex indices
-		for (size_t i_indices = 0; i_indices < indices.size(); ++i_indices) {
-			if (attrs[i_indices / 3] == i_mtl) {
-				mesh.tris.push_back(indices[i_indices]);
+		ObjSubset subset;
+		subset.mtl = mtls[i_mtl];
+		subset.vert_start = static_cast<uint32_t>(model.verts.size());
+		subset.index_start = static_cast<uint32_t>(model.indices.size());
+		subset.bbox_min = verts[sorted[face_start[i_mtl] * 3]].pos;
+		subset.bbox_max = subset.bbox_min;
+
+		for (size_t i_index = face_start[i_mtl] * 3; i_index < face_start[i_mtl + 1] * 3; ++i_index) {
+			uint32_t v = sorted[i_index];
+			if (owner[v] != i_mtl) {
+				owner[v] = i_mtl;
+				remap[v] = static_cast<uint32_t>(model.verts.size()) - subset.vert_start;
+				model.verts.push_back(verts[v]);
+
+				const Vector3f& pos = verts[v].pos;
+				subset.bbox_min.set((std::min)(subset.bbox_min.x, pos.x), (std::min)(subset.bbox_min.y, pos.y), (std::min)(subset.bbox_min.z, pos.z));
+				subset.bbox_max.set((std::max)(subset.bbox_max.x, pos.x), (std::max)(subset.bbox_max.y, pos.y), (std::max)(subset.bbox_max.z, pos.z));
 			}
+			model.indices.push_back(remap[v]);
 		}
 
-		// Set mesh indices.
-		if (!mesh.tris.empty()) {
-			meshs.push_back(mesh);
+		subset.vert_count = static_cast<uint32_t>(model.verts.size()) - subset.vert_start;
+		subset.index_count = static_cast<uint32_t>(model.indices.size()) - subset.index_start;
+		model.subsets.push_back(subset);
+	}
+
+	return true;
+}
+
+
+//binary cache next to the .obj, bump the version whenever the layout or the parser output changes
+const char kObjCacheMagic[8] = { 'S', 'K', 'R', 'M', 'E', 'S', 'H', '\0' };
+const uint32_t kObjCacheVersion = 3;
+
+struct ObjCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t flip_tex_v;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t file_size;
+	uint64_t vert_offset, vert_count;
+	uint64_t index_offset, index_count;
+	uint64_t subset_offset, subset_count;
+	uint64_t mtl_offset, mtl_count;
+	uint64_t string_offset, string_size;
+	float acmr_before, acmr_after;
+};
+
+//a .mtl the cached materials came from, size and mtime are 0 for a missing file
+struct ObjCacheSource {
+	uint64_t size;
+	int64_t mtime;
+	uint32_t name_offset, name_size;
+};
+
+//texture paths are stored relative to the .obj, so a moved resource dir keeps its cache
+struct ObjCacheSubset {
+	uint32_t vert_start, vert_count;
+	uint32_t index_start, index_count;
+	float bbox_min[3], bbox_max[3];
+	float ambient[3], diffuse[3], specular[3];
+	int32_t shininess;
+	float alpha;
+	uint32_t is_specular;
+	uint32_t name_offset, name_size;
+	uint32_t tex_name_offset, tex_name_size;
+};
+
+static_assert(sizeof(ObjVert) == 8 * sizeof(float), "ObjVert is stored as is in the cache");
+
+
+inline uint64_t AlignCacheOffset(uint64_t offset) {
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+
+//count elements of size bytes from offset end by limit, without overflowing on a corrupt header
+inline bool CacheRangeFits(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit) {
+	return offset <= limit && count <= (limit - offset) / size;
+}
+
+
+void MtlStamp(const _FSPFX path& dir_path, const std::string& mtl_fname, uint64_t& size, int64_t& mtime) {
+	_FSPFX path full_path = dir_path;
+	full_path.concat("/");
+	full_path.concat(mtl_fname);
+	if (!FileStamp(full_path.string(), size, mtime)) {
+		size = 0;
+		mtime = 0;
+	}
+}
+
+
+bool WriteObjCache(const std::string& cache_fname, const _FSPFX path& dir_path, const ObjModel& model, const std::vector<std::string>& mtl_fnames, ObjCacheHeader header) {
+	std::string strings;
+	std::vector<ObjCacheSource> mtls(mtl_fnames.size());
+	for (size_t i = 0; i != mtl_fnames.size(); i++) {
+		MtlStamp(dir_path, mtl_fnames[i], mtls[i].size, mtls[i].mtime);
+		mtls[i].name_offset = (uint32_t)strings.size();
+		mtls[i].name_size = (uint32_t)mtl_fnames[i].size();
+		strings += mtl_fnames[i];
+	}
+
+	std::vector<ObjCacheSubset> subsets(model.subsets.size());
+	for (size_t i = 0; i != model.subsets.size(); i++) {
+		const ObjSubset& src = model.subsets[i];
+		ObjCacheSubset& dst = subsets[i];
+
+		dst.vert_start = src.vert_start;
+		dst.vert_count = src.vert_count;
+		dst.index_start = src.index_start;
+		dst.index_count = src.index_count;
+		memcpy(dst.bbox_min, src.bbox_min.data(), sizeof(dst.bbox_min));
+		memcpy(dst.bbox_max, src.bbox_max.data(), sizeof(dst.bbox_max));
+		memcpy(dst.ambient, src.mtl.ambient.data(), sizeof(dst.ambient));
+		memcpy(dst.diffuse, src.mtl.diffuse.data(), sizeof(dst.diffuse));
+		memcpy(dst.specular, src.mtl.specular.data(), sizeof(dst.specular));
+		dst.shininess = src.mtl.shininess;
+		dst.alpha = src.mtl.alpha;
+		dst.is_specular = (src.mtl.is_specular ? 1 : 0);
+
+		dst.name_offset = (uint32_t)strings.size();
+		dst.name_size = (uint32_t)src.mtl.name.size();
+		strings += src.mtl.name;
+		dst.tex_name_offset = (uint32_t)strings.size();
+		dst.tex_name_size = (uint32_t)src.mtl.tex_name.size();
+		strings += src.mtl.tex_name;
+	}
+
+	header.vert_offset = AlignCacheOffset(sizeof(ObjCacheHeader));
+	header.vert_count = model.verts.size();
+	header.index_offset = AlignCacheOffset(header.vert_offset + header.vert_count * sizeof(ObjVert));
+	header.index_count = model.indices.size();
+	header.subset_offset = AlignCacheOffset(header.index_offset + header.index_count * sizeof(uint32_t));
+	header.subset_count = subsets.size();
+	header.mtl_offset = AlignCacheOffset(header.subset_offset + header.subset_count * sizeof(ObjCacheSubset));
+	header.mtl_count = mtls.size();
+	header.string_offset = header.mtl_offset + header.mtl_count * sizeof(ObjCacheSource);
+	header.string_size = strings.size();
+	header.file_size = header.string_offset + header.string_size;
+	header.acmr_before = model.acmr_before;
+	header.acmr_after = model.acmr_after;
+
+	//written aside and renamed into place, a crash mid-write leaves no torn cache behind
+	std::string temp_fname = cache_fname + ".tmp";
+	std::ofstream cachef(temp_fname, std::ios::binary | std::ios::trunc);
+	if (!cachef) return false;
+
+	auto write_at = [&](uint64_t offset, const void* data, size_t size) {
+		static const char zeros[16] = {};
+		uint64_t pos = (uint64_t)cachef.tellp();
+		cachef.write(zeros, (std::streamsize)(offset - pos));
+		cachef.write((const char*)data, (std::streamsize)size);
+	};
+
+	write_at(0, &header, sizeof(header));
+	write_at(header.vert_offset, model.verts.data(), model.verts.size() * sizeof(ObjVert));
+	write_at(header.index_offset, model.indices.data(), model.indices.size() * sizeof(uint32_t));
+	write_at(header.subset_offset, subsets.data(), subsets.size() * sizeof(ObjCacheSubset));
+	write_at(header.mtl_offset, mtls.data(), mtls.size() * sizeof(ObjCacheSource));
+	write_at(header.string_offset, strings.data(), strings.size());
+
+	cachef.close();
+	if (cachef.fail()) {
+		std::error_code ec;
+		_FSPFX remove(temp_fname, ec);
+		return false;
+	}
+	return CommitTempFile(temp_fname, cache_fname);
+}
+
+
+bool MapObjCache(const std::string& cache_fname, const _FSPFX path& dir_path, const ObjCacheHeader& expected, ObjModelView& model) {
+	std::shared_ptr<MappedFile> cachef = std::make_shared<MappedFile>();
+	if (!cachef->open(cache_fname) || cachef->size() < sizeof(ObjCacheHeader)) {
+		return false;
+	}
+
+	const char* data = cachef->data();
+	const ObjCacheHeader& header = *(const ObjCacheHeader*)data;
+	if (memcmp(header.magic, kObjCacheMagic, sizeof(kObjCacheMagic)) != 0
+		|| header.version != expected.version
+		|| header.flip_tex_v != expected.flip_tex_v
+		|| header.source_size != expected.source_size
+		|| header.source_mtime != expected.source_mtime
+		|| header.file_size != cachef->size()) {
+		return false;
+	}
+
+	//a truncated or hand-edited cache must not be trusted
+	if (!CacheRangeFits(header.vert_offset, header.vert_count, sizeof(ObjVert), header.index_offset)
+		|| !CacheRangeFits(header.index_offset, header.index_count, sizeof(uint32_t), header.subset_offset)
+		|| !CacheRangeFits(header.subset_offset, header.subset_count, sizeof(ObjCacheSubset), header.mtl_offset)
+		|| !CacheRangeFits(header.mtl_offset, header.mtl_count, sizeof(ObjCacheSource), header.string_offset)
+		|| !CacheRangeFits(header.string_offset, header.string_size, 1, header.file_size)) {
+		return false;
+	}
+
+	const ObjCacheSubset* subsets = (const ObjCacheSubset*)(data + header.subset_offset);
+	const ObjCacheSource* mtls = (const ObjCacheSource*)(data + header.mtl_offset);
+	const char* strings = data + header.string_offset;
+
+	//the materials are stale once any .mtl changed
+	for (size_t i = 0; i != (size_t)header.mtl_count; i++) {
+		const ObjCacheSource& src = mtls[i];
+		if ((uint64_t)src.name_offset + src.name_size > header.string_size) {
+			return false;
+		}
+
+		uint64_t size;
+		int64_t mtime;
+		MtlStamp(dir_path, std::string(strings + src.name_offset, src.name_size), size, mtime);
+		if (size != src.size || mtime != src.mtime) {
+			return false;
+		}
+	}
+
+	model.subsets.resize((size_t)header.subset_count);
+	for (size_t i = 0; i != model.subsets.size(); i++) {
+		const ObjCacheSubset& src = subsets[i];
+		ObjSubset& dst = model.subsets[i];
+
+		if ((uint64_t)src.vert_start + src.vert_count > header.vert_count
+			|| (uint64_t)src.index_start + src.index_count > header.index_count
+			|| (uint64_t)src.name_offset + src.name_size > header.string_size
+			|| (uint64_t)src.tex_name_offset + src.tex_name_size > header.string_size) {
+			model.subsets.clear();
+			return false;
 		}
+
+		//the indices go straight to the renderer, one past the subset's vertices reads out of bounds
+		const uint32_t* indices = (const uint32_t*)(data + header.index_offset) + src.index_start;
+		for (uint32_t k = 0; k != src.index_count; k++) {
+			if (indices[k] >= src.vert_count) {
+				model.subsets.clear();
+				return false;
+			}
+		}
+
+		dst.vert_start = src.vert_start;
+		dst.vert_count = src.vert_count;
+		dst.index_start = src.index_start;
+		dst.index_count = src.index_count;
+		dst.bbox_min.set(src.bbox_min[0], src.bbox_min[1], src.bbox_min[2]);
+		dst.bbox_max.set(src.bbox_max[0], src.bbox_max[1], src.bbox_max[2]);
+		dst.mtl.ambient.set(src.ambient[0], src.ambient[1], src.ambient[2]);
+		dst.mtl.diffuse.set(src.diffuse[0], src.diffuse[1], src.diffuse[2]);
+		dst.mtl.specular.set(src.specular[0], src.specular[1], src.specular[2]);
+		dst.mtl.shininess = src.shininess;
+		dst.mtl.alpha = src.alpha;
+		dst.mtl.is_specular = (src.is_specular != 0);
+		dst.mtl.name.assign(strings + src.name_offset, src.name_size);
+		dst.mtl.tex_name.assign(strings + src.tex_name_offset, src.tex_name_size);
+
+		//same as LoadObjMtl
+		if (!dst.mtl.tex_name.empty()) {
+			_FSPFX path full_path = dir_path;
+			full_path.concat("/");
+			full_path.concat(dst.mtl.tex_name);
+			dst.mtl.tex_full_path = full_path.string();
+		}
+	}
+
+	model.verts = (const ObjVert*)(data + header.vert_offset);
+	model.vert_count = (size_t)header.vert_count;
+	model.indices = (const uint32_t*)(data + header.index_offset);
+	model.index_count = (size_t)header.index_count;
+	model.acmr_before = header.acmr_before;
+	model.acmr_after = header.acmr_after;
+	model.storage = cachef;
+	return true;
+}
+
+
+bool LoadObjModelView(const std::string& fname, ObjModelView& model, bool flip_tex_v) {
+	std::string obj_fname = _FSPFX absolute(fname, ResourceDir()).string();
+	std::string cache_fname = obj_fname + ".cache";
+	_FSPFX path dir_path = _FSPFX absolute(_FSPFX path(obj_fname)).parent_path();
+
+	ObjCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kObjCacheMagic, sizeof(kObjCacheMagic));
+	header.version = kObjCacheVersion;
+	header.flip_tex_v = (flip_tex_v ? 1 : 0);
+	if (!FileStamp(obj_fname, header.source_size, header.source_mtime)) {
+		return false;
+	}
+
+	if (MapObjCache(cache_fname, dir_path, header, model)) {
+		return true;
+	}
+
+	std::shared_ptr<ObjModel> parsed = std::make_shared<ObjModel>();
+	std::vector<std::string> mtl_fnames;
+	if (!ParseObjModel(obj_fname, *parsed, mtl_fnames, flip_tex_v)) {
+		return false;
+	}
+	OptimizeObjModel(*parsed);
+
+	if (WriteObjCache(cache_fname, dir_path, *parsed, mtl_fnames, header) && MapObjCache(cache_fname, dir_path, header, model)) {
+		return true;
+	}
+
+	//read-only resource dir, serve the parsed model
+	model.verts = parsed->verts.data();
+	model.vert_count = parsed->verts.size();
+	model.indices = parsed->indices.data();
+	model.index_count = parsed->indices.size();
+	model.subsets = parsed->subsets;
+	model.acmr_before = parsed->acmr_before;
+	model.acmr_after = parsed->acmr_after;
+	model.storage = parsed;
+	return true;
+}
+
+
+bool LoadObjModel(const std::string& fname, ObjModel& model, bool flip_tex_v) {
+	ObjModelView view;
+	if (!LoadObjModelView(fname, view, flip_tex_v)) {
+		return false;
+	}
+
+	model.verts.assign(view.verts, view.verts + view.vert_count);
+	model.indices.assign(view.indices, view.indices + view.index_count);
+	model.subsets = view.subsets;
+	model.acmr_before = view.acmr_before;
+	model.acmr_after = view.acmr_after;
+	return true;
+}
+
+
+bool LoadObjMesh(const std::string& fname, std::vector<ObjMesh>& meshs, bool flip_tex_v) {
+	ObjModelView model;
+	if (!LoadObjModelView(fname, model, flip_tex_v)) {
+		return false;
+	}
+
+	for (auto i = model.subsets.begin(); i != model.subsets.end(); i++) {
+		ObjMesh mesh;
+
+		mesh.mtl = i->mtl;
+		mesh.verts.assign(model.verts + i->vert_start, model.verts + i->vert_start + i->vert_count);
+		mesh.tris.assign(model.indices + i->index_start, model.indices + i->index_start + i->index_count);
+
+		meshs.push_back(mesh);
 	}
 
 	return true;
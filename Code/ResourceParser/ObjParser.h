@@ -5,6 +5,7 @@
 #include "SoftRenderer/SoftSurface.h"
 #include <vector>
 #include <string>
+#include <memory>
 
 
 #pragma warning(push) 
@@ -51,7 +52,50 @@ public:
 };
 
 
+//faces of one material, its vertices are contiguous in the model and its indices are relative to vert_start
+class RESPARSER_DLL ObjSubset {
+public:
+	ObjSubset() : vert_start(0), vert_count(0), index_start(0), index_count(0) {}
+
+	ObjMtl mtl;
+	uint32_t vert_start, vert_count;
+	uint32_t index_start, index_count;
+	shakuras::Vector3f bbox_min, bbox_max;
+};
+
+
+class RESPARSER_DLL ObjModel {
+public:
+	ObjModel() : acmr_before(0.0f), acmr_after(0.0f) {}
+
+	std::vector<ObjVert> verts;
+	std::vector<uint32_t> indices;
+	std::vector<ObjSubset> subsets;
+	float acmr_before, acmr_after;//vertex cache misses per triangle, as in the file and after OptimizeObjModel
+};
+
+
+//ObjModel without copies, verts and indices point into the mapped mesh cache
+//storage keeps the mapping (or the parsed model, when the cache can not be written) alive
+class RESPARSER_DLL ObjModelView {
+public:
+	ObjModelView() : verts(nullptr), vert_count(0), indices(nullptr), index_count(0), acmr_before(0.0f), acmr_after(0.0f) {}
+
+	const ObjVert* verts;
+	size_t vert_count;
+	const uint32_t* indices;
+	size_t index_count;
+	std::vector<ObjSubset> subsets;
+	float acmr_before, acmr_after;
+	std::shared_ptr<void> storage;
+};
+
+
+//all of them go through the binary cache "<fname>.cache", rebuilt when the size or mtime of the .obj or its .mtl changes
+//the cache is built with the triangles and vertices reordered by OptimizeObjModel
 RESPARSER_DLL bool LoadObjMesh(const std::string& fname, std::vector<ObjMesh>& meshs, bool flip_tex_v);
+RESPARSER_DLL bool LoadObjModel(const std::string& fname, ObjModel& model, bool flip_tex_v);
+RESPARSER_DLL bool LoadObjModelView(const std::string& fname, ObjModelView& model, bool flip_tex_v);
 
 
 #pragma warning(pop)
\ No newline at end of file
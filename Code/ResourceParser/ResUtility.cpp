@@ -1,6 +1,9 @@
 #include "ResUtility.h"
 #include <fstream>
 #include <filesystem>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
 
 
 _FSPFX path g_resourcedir;
@@ -37,6 +40,100 @@ _FSPFX path ResourceDir() {
 }
 
 
+std::string CanonicalPath(std::string filepath, bool isrelpath) {
+	_FSPFX path p = (isrelpath ? _FSPFX absolute(filepath, ResourceDir()) : _FSPFX absolute(filepath));
+
+	//missing files keep their absolute path
+	std::error_code ec;
+	_FSPFX path canonical = _FSPFX canonical(p, ec);
+	return (ec ? p : canonical).string();
+}
+
+
+bool FileStamp(const std::string& fname, uint64_t& size, int64_t& mtime) {
+	std::error_code ec;
+	size = (uint64_t)_FSPFX file_size(fname, ec);
+	if (ec) return false;
+
+	mtime = (int64_t)_FSPFX last_write_time(fname, ec).time_since_epoch().count();
+	return !ec;
+}
+
+
+bool CommitTempFile(const std::string& temp_fname, const std::string& fname) {
+	//rename of the filesystem library may refuse an existing target, this one replaces it
+	//it still fails while another view maps the old file
+	if (MoveFileExW(_FSPFX path(temp_fname).wstring().c_str(), _FSPFX path(fname).wstring().c_str(), MOVEFILE_REPLACE_EXISTING)) {
+		return true;
+	}
+
+	DeleteFileW(_FSPFX path(temp_fname).wstring().c_str());
+	return false;
+}
+
+
 void ResFree(void* buffer) {
 	free(buffer);
+}
+
+
+MappedFile::MappedFile() : file_(INVALID_HANDLE_VALUE), mapping_(NULL), data_(nullptr), size_(0) {}
+
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+
+bool MappedFile::open(const std::string& fname) {
+	close();
+
+	file_ = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER sz;
+	if (!GetFileSizeEx(file_, &sz)) {
+		close();
+		return false;
+	}
+
+	//an empty file can not be mapped, it is still a valid open
+	if (sz.QuadPart == 0) {
+		return true;
+	}
+
+	mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping_) {
+		close();
+		return false;
+	}
+
+	data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+	if (!data_) {
+		close();
+		return false;
+	}
+
+	size_ = (size_t)sz.QuadPart;
+	return true;
+}
+
+
+void MappedFile::close() {
+	if (data_) {
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_) {
+		CloseHandle(mapping_);
+	}
+	if (file_ != INVALID_HANDLE_VALUE) {
+		CloseHandle(file_);
+	}
+
+	file_ = INVALID_HANDLE_VALUE;
+	mapping_ = NULL;
+	data_ = nullptr;
+	size_ = 0;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <stdint.h>
 #include <filesystem>
 
 
@@ -16,4 +17,40 @@ void LoadResourceDir(std::string cfg_fname = "ResourceDir.cfg");
 _FSPFX path ResourceDir();
 
 
-RESPARSER_DLL void ResFree(void* buffer);
\ No newline at end of file
+//absolute, with "." and ".." resolved, the key for sharing loaded resources
+RESPARSER_DLL std::string CanonicalPath(std::string filepath, bool isrelpath);
+
+
+//size and last write time, what the binary caches are validated against
+bool FileStamp(const std::string& fname, uint64_t& size, int64_t& mtime);
+
+
+//moves a fully written temporary file over the cache it replaces, the temporary is removed when that fails
+bool CommitTempFile(const std::string& temp_fname, const std::string& fname);
+
+
+RESPARSER_DLL void ResFree(void* buffer);
+
+
+//read-only view of a whole file
+class RESPARSER_DLL MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+	bool open(const std::string& fname);
+	void close();
+
+	inline const char* data() const { return data_; }
+	inline size_t size() const { return size_; }
+
+private:
+	void* file_;
+	void* mapping_;
+	const char* data_;
+	size_t size_;
+};
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+#include "ResUtility.h"
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <ppltasks.h>
+
+
+//textures keyed by canonical path, each unique file is built once on a worker thread
+//every material that references the same file gets the same handle
+template<class T>
+class TextureCache {
+public:
+	typedef std::shared_ptr<T> handle_t;
+	typedef std::function<handle_t(const std::string& full_path)> builder_t;
+
+public:
+	explicit TextureCache(builder_t builder) : builder_(builder) {}
+	~TextureCache() { wait(); }
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+public:
+	//starts building a file not seen before, request everything first to build in parallel
+	void request(const std::string& filepath, bool isrelpath) {
+		entry(CanonicalPath(filepath, isrelpath));
+	}
+
+	//waits for the build, nullptr if it failed
+	handle_t get(const std::string& filepath, bool isrelpath) {
+		return entry(CanonicalPath(filepath, isrelpath)).get();
+	}
+
+	void wait() {
+		std::vector<Concurrency::task<handle_t> > tasks;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (auto i = entries_.begin(); i != entries_.end(); i++) {
+				tasks.push_back(i->second);
+			}
+		}
+
+		for (auto i = tasks.begin(); i != tasks.end(); i++) {
+			i->wait();
+		}
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return entries_.size();
+	}
+
+private:
+	Concurrency::task<handle_t> entry(const std::string& key) {
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto i = entries_.find(key);
+		if (i != entries_.end()) {
+			return i->second;
+		}
+
+		builder_t builder = builder_;
+		Concurrency::task<handle_t> build = Concurrency::create_task([builder, key]() {
+			return builder(key);
+		});
+		entries_.insert(std::make_pair(key, build));
+		return build;
+	}
+
+private:
+	builder_t builder_;
+	std::mutex mutex_;
+	std::map<std::string, Concurrency::task<handle_t> > entries_;
+};
\ No newline at end of file
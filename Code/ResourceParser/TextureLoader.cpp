@@ -2,6 +2,8 @@
 
 #define STB_IMAGE_IMPLEMENTATION 1
 #include "stb_image.h"
+#include <emmintrin.h>
+#include <string.h>
 
 
 void* GridTexture(int& width, int& height, uint32_t c1, uint32_t c2) {
@@ -22,7 +24,36 @@ void* GridTexture(int& width, int& height, uint32_t c1, uint32_t c2) {
 }
 
 
+//swaps bytes 0 and 2 of every texel, dst may be src
+static void SwizzleRB(const uint8_t* src, uint8_t* dst, size_t count) {
+	const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128i rb = _mm_and_si128(x, rb_mask);
+		__m128i ga = _mm_andnot_si128(rb_mask, x);
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(rb, ga));
+	}
+
+	for (; i < count; i++) {
+		uint8_t r = src[i * 4];
+		uint8_t b = src[i * 4 + 2];
+		dst[i * 4] = b;
+		dst[i * 4 + 1] = src[i * 4 + 1];
+		dst[i * 4 + 2] = r;
+		dst[i * 4 + 3] = src[i * 4 + 3];
+	}
+}
+
+
 void* LoadTexture(std::string filepath, bool isrelpath, int& width, int& height) {
+	return LoadTexture(filepath, isrelpath, width, height, kTextureRGBA8);
+}
+
+
+void* LoadTexture(std::string filepath, bool isrelpath, int& width, int& height, int format, TextureAllocator alloc) {
 	if (isrelpath) {
 		filepath = _FSPFX absolute(filepath, ResourceDir()).string();
 	}
@@ -33,20 +64,44 @@ void* LoadTexture(std::string filepath, bool isrelpath, int& width, int& height)
 		return nullptr;
 	}
 
-	uint8_t* buffer = (uint8_t*)malloc(sizeof(uint32_t) * width * height);
+	size_t count = (size_t)width * height;
 
-	for (int j = 0; j < height; ++j) {
-		for (int i = 0; i < width; ++i) {
-			const unsigned char* pp_src = data + 4 * (j * width + i);
-			unsigned char* pp_dst = buffer + 4 * (j * width + i);
-			pp_dst[0] = pp_src[0];
-			pp_dst[1] = pp_src[1];
-			pp_dst[2] = pp_src[2];
-			pp_dst[3] = pp_src[3];
+	//stb_image allocates with malloc, so its buffer can be released by ResFree
+	uint8_t* buffer = (alloc ? (uint8_t*)alloc(width, height) : data);
+	if (buffer) {
+		if (format == kTextureBGRA8) {
+			SwizzleRB(data, buffer, count);
+		}
+		else if (buffer != data) {
+			memcpy(buffer, data, count * 4);
 		}
 	}
 
-	stbi_image_free(data);
+	if (buffer != data) {
+		stbi_image_free(data);
+	}
 
 	return buffer;
+}
+
+
+//header only, no decoding
+bool TextureInfo(std::string filepath, bool isrelpath, int& width, int& height) {
+	if (isrelpath) {
+		filepath = _FSPFX absolute(filepath, ResourceDir()).string();
+	}
+
+	int comp = 0;
+	return stbi_info(filepath.c_str(), &width, &height, &comp) != 0;
+}
+
+TextureImage::~TextureImage() {
+	ResFree(bits);
+}
+
+
+TextureImagePtr LoadTextureImage(std::string filepath, bool isrelpath) {
+	TextureImagePtr image = std::make_shared<TextureImage>();
+	image->bits = LoadTexture(filepath, isrelpath, image->width, image->height);
+	return (image->bits ? image : nullptr);
 }
\ No newline at end of file
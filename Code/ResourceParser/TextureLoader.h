@@ -1,7 +1,42 @@
 #pragma once
 #include "ResUtility.h"
+#include <memory>
+#include <functional>
 
 
 //textureԴ
 RESPARSER_DLL void* GridTexture(int& width, int& height, uint32_t c1 = 0xffffff, uint32_t c2 = 0x000000);
-RESPARSER_DLL void* LoadTexture(std::string filepath, bool isrelpath, int& width, int& height);
\ No newline at end of file
+RESPARSER_DLL void* LoadTexture(std::string filepath, bool isrelpath, int& width, int& height);
+
+
+//texel layout in memory
+enum TextureFormat {
+	kTextureRGBA8 = 0,//as decoded, what the GL renderer uploads
+	kTextureBGRA8 = 1//uint32_t 0xAARRGGBB, the soft renderer's ColorFormatU32F3
+};
+
+//storage for width * height texels, nullptr rejects the texture
+typedef std::function<void*(int width, int height)> TextureAllocator;
+
+//converts into alloc's storage in a single pass and returns it
+//without alloc the decoder's own buffer is converted in place and handed over, release it with ResFree
+RESPARSER_DLL void* LoadTexture(std::string filepath, bool isrelpath, int& width, int& height, int format, TextureAllocator alloc = nullptr);
+RESPARSER_DLL bool TextureInfo(std::string filepath, bool isrelpath, int& width, int& height);
+
+
+//LoadTexture result that frees itself
+class RESPARSER_DLL TextureImage {
+public:
+	TextureImage() : width(0), height(0), bits(nullptr) {}
+	~TextureImage();
+
+	TextureImage(const TextureImage&) = delete;
+	TextureImage& operator=(const TextureImage&) = delete;
+
+	int width, height;
+	void* bits;
+};
+
+typedef std::shared_ptr<TextureImage> TextureImagePtr;
+
+RESPARSER_DLL TextureImagePtr LoadTextureImage(std::string filepath, bool isrelpath);
\ No newline at end of file
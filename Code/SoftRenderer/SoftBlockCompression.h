@@ -0,0 +1,244 @@
+#pragma once
+#include "Core/Utility.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+
+
+SHAKURAS_BEGIN;
+
+
+//storage of a surface level
+enum SoftBlockFormat {
+	kBlockNone = 0,
+	kBlockBC1 = 1,//8 bytes per 4x4 block, rgb
+	kBlockBC3 = 2//16 bytes per 4x4 block, rgb + interpolated alpha
+};
+
+
+inline size_t BlockBytes(int block) {
+	return (block == kBlockBC1 ? 8 : (block == kBlockBC3 ? 16 : 0));
+}
+
+
+//texels are uint32_t - b, g, r, a, same as ColorFormatU32F3
+inline uint32_t PackTexel(int r, int g, int b, int a) {
+	return (uint32_t)b | ((uint32_t)g << 8) | ((uint32_t)r << 16) | ((uint32_t)a << 24);
+}
+
+inline int TexelR(uint32_t t) { return (t >> 16) & 0xff; }
+inline int TexelG(uint32_t t) { return (t >> 8) & 0xff; }
+inline int TexelB(uint32_t t) { return t & 0xff; }
+inline int TexelA(uint32_t t) { return (t >> 24) & 0xff; }
+
+
+inline uint16_t PackRGB565(int r, int g, int b) {
+	return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+inline void UnpackRGB565(uint16_t c, int& r, int& g, int& b) {
+	r = (c >> 11) & 31;
+	g = (c >> 5) & 63;
+	b = c & 31;
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+}
+
+
+//palette[0..3] of a color block, four_color is forced for BC3
+inline void ColorPalette(uint16_t c0, uint16_t c1, bool four_color, uint32_t palette[4]) {
+	int r0, g0, b0, r1, g1, b1;
+	UnpackRGB565(c0, r0, g0, b0);
+	UnpackRGB565(c1, r1, g1, b1);
+
+	palette[0] = PackTexel(r0, g0, b0, 255);
+	palette[1] = PackTexel(r1, g1, b1, 255);
+
+	if (four_color || c0 > c1) {
+		palette[2] = PackTexel((2 * r0 + r1) / 3, (2 * g0 + g1) / 3, (2 * b0 + b1) / 3, 255);
+		palette[3] = PackTexel((r0 + 2 * r1) / 3, (g0 + 2 * g1) / 3, (b0 + 2 * b1) / 3, 255);
+	}
+	else {
+		palette[2] = PackTexel((r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2, 255);
+		palette[3] = PackTexel(0, 0, 0, 0);
+	}
+}
+
+inline void AlphaPalette(int a0, int a1, int palette[8]) {
+	palette[0] = a0;
+	palette[1] = a1;
+
+	if (a0 > a1) {
+		for (int i = 1; i != 7; i++) {
+			palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+		}
+	}
+	else {
+		for (int i = 1; i != 5; i++) {
+			palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+
+inline int ColorDistance(uint32_t t1, uint32_t t2) {
+	int dr = TexelR(t1) - TexelR(t2);
+	int dg = TexelG(t1) - TexelG(t2);
+	int db = TexelB(t1) - TexelB(t2);
+	return dr * dr + dg * dg + db * db;
+}
+
+
+//bounding box encoder, the box diagonal is flipped to follow the sign of the r-g/r-b covariance
+inline void EncodeColorBlock(const uint32_t texels[16], bool four_color, uint8_t* out) {
+	int minc[3] = { 255, 255, 255 }, maxc[3] = { 0, 0, 0 };
+	int sum[3] = { 0, 0, 0 };
+	for (int i = 0; i != 16; i++) {
+		int c[3] = { TexelR(texels[i]), TexelG(texels[i]), TexelB(texels[i]) };
+		for (int k = 0; k != 3; k++) {
+			minc[k] = (std::min)(minc[k], c[k]);
+			maxc[k] = (std::max)(maxc[k], c[k]);
+			sum[k] += c[k];
+		}
+	}
+
+	int cov_rg = 0, cov_rb = 0;
+	for (int i = 0; i != 16; i++) {
+		int dr = TexelR(texels[i]) * 16 - sum[0];
+		cov_rg += dr * (TexelG(texels[i]) * 16 - sum[1]);
+		cov_rb += dr * (TexelB(texels[i]) * 16 - sum[2]);
+	}
+	if (cov_rg < 0) std::swap(minc[1], maxc[1]);
+	if (cov_rb < 0) std::swap(minc[2], maxc[2]);
+
+	//inset by 1/16 of the range, the extremes are rarely hit exactly
+	for (int k = 0; k != 3; k++) {
+		int inset = (maxc[k] - minc[k]) / 16;
+		maxc[k] -= inset;
+		minc[k] += inset;
+	}
+
+	uint16_t c0 = PackRGB565(maxc[0], maxc[1], maxc[2]);
+	uint16_t c1 = PackRGB565(minc[0], minc[1], minc[2]);
+	if (!four_color && c0 < c1) {
+		std::swap(c0, c1);
+	}
+
+	uint32_t palette[4];
+	ColorPalette(c0, c1, four_color, palette);
+	//c0 == c1 selects the 3-color mode for BC1, only index 0 is meaningful then
+	int npal = (four_color || c0 > c1 ? 4 : 1);
+
+	uint32_t indices = 0;
+	for (int i = 0; i != 16; i++) {
+		int best = 0;
+		int best_dist = ColorDistance(texels[i], palette[0]);
+		for (int p = 1; p < npal; p++) {
+			int dist = ColorDistance(texels[i], palette[p]);
+			if (dist < best_dist) {
+				best_dist = dist;
+				best = p;
+			}
+		}
+		indices |= (uint32_t)best << (2 * i);
+	}
+
+	out[0] = (uint8_t)(c0 & 0xff);
+	out[1] = (uint8_t)(c0 >> 8);
+	out[2] = (uint8_t)(c1 & 0xff);
+	out[3] = (uint8_t)(c1 >> 8);
+	out[4] = (uint8_t)(indices & 0xff);
+	out[5] = (uint8_t)((indices >> 8) & 0xff);
+	out[6] = (uint8_t)((indices >> 16) & 0xff);
+	out[7] = (uint8_t)(indices >> 24);
+}
+
+inline void DecodeColorBlock(const uint8_t* in, bool four_color, uint32_t texels[16]) {
+	uint16_t c0 = (uint16_t)(in[0] | (in[1] << 8));
+	uint16_t c1 = (uint16_t)(in[2] | (in[3] << 8));
+	uint32_t indices = (uint32_t)in[4] | ((uint32_t)in[5] << 8) | ((uint32_t)in[6] << 16) | ((uint32_t)in[7] << 24);
+
+	uint32_t palette[4];
+	ColorPalette(c0, c1, four_color, palette);
+
+	for (int i = 0; i != 16; i++) {
+		texels[i] = palette[(indices >> (2 * i)) & 3];
+	}
+}
+
+
+inline void EncodeAlphaBlock(const uint32_t texels[16], uint8_t* out) {
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i != 16; i++) {
+		a0 = (std::max)(a0, TexelA(texels[i]));
+		a1 = (std::min)(a1, TexelA(texels[i]));
+	}
+
+	int palette[8];
+	AlphaPalette(a0, a1, palette);
+
+	uint64_t indices = 0;
+	if (a0 != a1) {
+		for (int i = 0; i != 16; i++) {
+			int a = TexelA(texels[i]);
+			int best = 0;
+			int best_dist = abs(a - palette[0]);
+			for (int p = 1; p != 8; p++) {
+				int dist = abs(a - palette[p]);
+				if (dist < best_dist) {
+					best_dist = dist;
+					best = p;
+				}
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+	}
+
+	out[0] = (uint8_t)a0;
+	out[1] = (uint8_t)a1;
+	for (int i = 0; i != 6; i++) {
+		out[2 + i] = (uint8_t)((indices >> (8 * i)) & 0xff);
+	}
+}
+
+inline void DecodeAlphaBlock(const uint8_t* in, uint32_t texels[16]) {
+	int palette[8];
+	AlphaPalette(in[0], in[1], palette);
+
+	uint64_t indices = 0;
+	for (int i = 0; i != 6; i++) {
+		indices |= (uint64_t)in[2 + i] << (8 * i);
+	}
+
+	for (int i = 0; i != 16; i++) {
+		uint32_t a = (uint32_t)palette[(indices >> (3 * i)) & 7];
+		texels[i] = (texels[i] & 0x00ffffff) | (a << 24);
+	}
+}
+
+
+inline void EncodeBlock(int block, const uint32_t texels[16], uint8_t* out) {
+	if (block == kBlockBC1) {
+		EncodeColorBlock(texels, false, out);
+	}
+	else if (block == kBlockBC3) {
+		EncodeAlphaBlock(texels, out);
+		EncodeColorBlock(texels, true, out + 8);
+	}
+}
+
+inline void DecodeBlock(int block, const uint8_t* in, uint32_t texels[16]) {
+	if (block == kBlockBC1) {
+		DecodeColorBlock(in, false, texels);
+	}
+	else if (block == kBlockBC3) {
+		DecodeColorBlock(in + 8, true, texels);
+		DecodeAlphaBlock(in, texels);
+	}
+}
+
+
+SHAKURAS_END;
\ No newline at end of file
@@ -4,12 +4,17 @@
 #include "Core/Profiler.h"
 #include <algorithm>
 #include <array>
+#include <limits>
 #include <map>
 
 
 SHAKURAS_BEGIN;
 
 
+//screen coordinates the fixed point of the rasterizer can hold, edge products stay within 64 bits
+const float kSubPixelRange = (float)(1 << 26);
+
+
 inline bool IsCounterClockwise(const Vector4f& pos0, const Vector4f& pos1, const Vector4f& pos2) {
 	Vector2f pv_2d[3] =
 	{
@@ -38,46 +43,70 @@ inline V SignedDistanceLerp(const V& v1, const V& v2, float d1, float d2) {
 }
 
 
-template<class A, class V >
+template<class A, class V, class I = uint32_t>
 class SoftClipper {
 public:
 	SoftClipper() {
 		iprims_ = nullptr;
 		profiler_ = nullptr;
 		refuse_back_ = true;
+		guard_ = 1.0f;
 	}
 
 public:
-	void reset(SoftPrimitiveList<A, V>& prims, Profiler& profiler, bool refuse_back) {
+	//width and height of the viewport size the guard band, whose corners map to within half of kSubPixelRange
+	void reset(SoftPrimitiveList<A, V, I>& prims, Profiler& profiler, bool refuse_back, float width, float height) {
 		iprims_ = &prims;
 		profiler_ = &profiler;
 		refuse_back_ = refuse_back;
+		guard_ = 0.5f * kSubPixelRange / (std::max)({ width, height, 1.0f });
 
-		oris_.clear();
-		neards_.clear();
-		fards_.clear();
+		oris_.assign(prims.verts_.size(), -1);
+		outcodes_.resize(prims.verts_.size());
+		neards_.resize(prims.verts_.size());
+		fards_.resize(prims.verts_.size());
 
 		lerps_.clear();
 		lerpdict_.clear();
+		dropped_.clear();
+		guarded_.clear();
 
 		tridict_.clear();
 
 		overts_.clear();
+		opositions_.clear();
 		oindexs_.clear();
 	}
 
+	//classifies vertex i against the near and far planes, called by the geometry stage as each vertex
+	//is shaded, for every vertex of the triangles, in any order and from any thread
+	void orientate(size_t i) {
+		Vector4f pos = position(i);
+		float neard = 0.0f, fard = 0.0f;
+		oris_[i] = orientate(pos, neard, fard);
+		neards_[i] = neard;
+		fards_[i] = fard;
+		outcodes_[i] = outcode(pos, neard, fard);
+	}
+
+	//the vertices it creates are appended to verts_ and positions_, the others stay where they are
 	void process() {
 		if (!iprims_ || !profiler_) {
 			return;
 		}
-		
-		computeOrientate();
 
 		computeLerpVertex();
 
 		computeClipedTriangle();
 
-		iprims_->verts_.swap(overts_);
+		SoftVertexStream<4>& positions = iprims_->positions_;
+		size_t base = iprims_->verts_.size();
+		positions.resize(base + opositions_.size());
+		for (size_t i = 0; i != opositions_.size(); i++) {
+			positions.setVector4(base + i, opositions_[i]);
+		}
+
+		iprims_->verts_.insert(iprims_->verts_.end(), overts_.begin(), overts_.end());
 		iprims_->indexs_.swap(oindexs_);
 	}
 
@@ -104,22 +133,82 @@ private:
 		return kOK;
 	}
 
-	void computeOrientate() {
-		oris_.resize(iprims_->verts_.size(), -1);
-		neards_.resize(iprims_->verts_.size());
-		fards_.resize(iprims_->verts_.size());
-		
-		auto calc_orient = [&](size_t i) {
-			float neard = 0.0f, fard = 0.0f;
-			oris_[i] = orientate(iprims_->verts_[i].pos, neard, fard);
-			neards_[i] = neard;
-			fards_[i] = fard;
-		};
+	//the clip volume planes a vertex is outside of, then the guard band planes at x, y = -guard_ * w, guard_ * w
+	enum {
+		kOutLeft = 1 << 0,
+		kOutRight = 1 << 1,
+		kOutBottom = 1 << 2,
+		kOutTop = 1 << 3,
+		kOutNear = 1 << 4,
+		kOutFar = 1 << 5,
+		kOutGuardLeft = 1 << 6,
+		kOutGuardRight = 1 << 7,
+		kOutGuardBottom = 1 << 8,
+		kOutGuardTop = 1 << 9,
+		kOutVolume = 0x3f,
+		kOutGuard = 0x3c0,
+	};
 
-		Concurrency::parallel_for(size_t(0), iprims_->verts_.size(), calc_orient);
+	//a corner of a triangle clipped against the guard band
+	struct GuardCorner {
+		I index;//the largest index for a corner made by clipping
+		Vector4f pos;
+		V varyings;
+	};
+
+	inline Vector4f position(size_t i) const {
+		return iprims_->positions_.vector4(i);
+	}
+
+	inline uint16_t outcode(const Vector4f& pos, float neard, float fard) {
+		int code = 0;
+		code |= (pos.x < -pos.w ? kOutLeft : 0);
+		code |= (pos.x > pos.w ? kOutRight : 0);
+		code |= (pos.y < -pos.w ? kOutBottom : 0);
+		code |= (pos.y > pos.w ? kOutTop : 0);
+		code |= (neard < 0 ? kOutNear : 0);
+		code |= (fard < 0 ? kOutFar : 0);
+		//behind the eye the guard planes say nothing, the near clip decides where such corners end up
+		if (pos.w > 0) {
+			code |= (pos.x < -guard_ * pos.w ? kOutGuardLeft : 0);
+			code |= (pos.x > guard_ * pos.w ? kOutGuardRight : 0);
+			code |= (pos.y < -guard_ * pos.w ? kOutGuardBottom : 0);
+			code |= (pos.y > guard_ * pos.w ? kOutGuardTop : 0);
+		}
+		return (uint16_t)code;
 	}
 
-	void allocLerpVertex(size_t i1, size_t i2, short o1, short o2) {
+	//whether the near or far clip of the edge i1, i2 lands past the guard band, with the weights the lerp uses
+	bool lerpPastGuard(I i1, I i2, short o1, short o2) {
+		if (o1 == o2) {
+			return false;
+		}
+
+		bool past = false;
+		if (o1 == kTooNear || o2 == kTooNear) {
+			Vector4f pos = SignedDistanceLerp(position(i1), position(i2), neards_[i1], neards_[i2]);
+			past = past || (outcode(pos, 0.0f, 0.0f) & kOutGuard) != 0;
+		}
+		if (o1 == kTooFar || o2 == kTooFar) {
+			Vector4f pos = SignedDistanceLerp(position(i1), position(i2), fards_[i1], fards_[i2]);
+			past = past || (outcode(pos, 0.0f, 0.0f) & kOutGuard) != 0;
+		}
+		return past;
+	}
+
+	//signed distance to a plane, positive inside: near, far, then the guard band left, right, bottom, top
+	inline float guardDistance(const Vector4f& pos, int plane) const {
+		switch (plane) {
+		case 0: return pos.z;
+		case 1: return pos.w - pos.z;
+		case 2: return pos.x + guard_ * pos.w;
+		case 3: return guard_ * pos.w - pos.x;
+		case 4: return pos.y + guard_ * pos.w;
+		default: return guard_ * pos.w - pos.y;
+		}
+	}
+
+	void allocLerpVertex(I i1, I i2, short o1, short o2) {
 		if (o1 == o2) {
 			return;
 		}
@@ -131,63 +220,121 @@ private:
 			auto mm = std::minmax(i1, i2);
 
 			lerps_.push_back(mm);
-			lerpdict_[mm.first][mm.second][oo] = overts_.size();
+			lerpdict_[mm.first][mm.second][oo] = (I)(iprims_->verts_.size() + overts_.size());
 			overts_.push_back(SoftVertex<A, V>());
+			opositions_.push_back(Vector4f());
 		}
 		else {
 			//ֵ
 			auto mm = std::minmax(i1, i2);
 
 			lerps_.push_back(mm);
-			lerpdict_[mm.first][mm.second][kTooNear] = overts_.size();
+			lerpdict_[mm.first][mm.second][kTooNear] = (I)(iprims_->verts_.size() + overts_.size());
 			overts_.push_back(SoftVertex<A, V>());
-			lerpdict_[mm.first][mm.second][kTooFar] = overts_.size();
+			opositions_.push_back(Vector4f());
+			lerpdict_[mm.first][mm.second][kTooFar] = (I)(iprims_->verts_.size() + overts_.size());
 			overts_.push_back(SoftVertex<A, V>());
+			opositions_.push_back(Vector4f());
 		}
 	}
 
-	size_t lerpIndex(size_t i1, size_t i2, short flag) {
+	I lerpIndex(I i1, I i2, short flag) {
 		auto mm = std::minmax(i1, i2);
 		return lerpdict_[mm.first][mm.second][flag];
 	}
 
 	void computeLerpVertex() {
-		overts_ = iprims_->verts_;
+		const std::vector<SoftVertex<A, V> >& iverts = iprims_->verts_;
+		const size_t base = iverts.size();
+
+		//a narrow index type can run out of room for clip vertices, such triangles are dropped
+		//the largest index stays free, it marks unfilled output
+		const size_t limit = (std::numeric_limits<I>::max)();
+		dropped_.assign(iprims_->indexs_.size() / 3, 0);
+		guarded_.assign(iprims_->indexs_.size() / 3, 0);
+		int overflow = 0;
+		std::array<int, 6> rejected = { 0, 0, 0, 0, 0, 0 };
 
 		//ռ
 		for (size_t i = 0; i != iprims_->indexs_.size(); i += 3) {
-			const size_t i1 = iprims_->indexs_[i];
-			const size_t i2 = iprims_->indexs_[i + 1];
-			const size_t i3 = iprims_->indexs_[i + 2];
+			const I i1 = iprims_->indexs_[i];
+			const I i2 = iprims_->indexs_[i + 1];
+			const I i3 = iprims_->indexs_[i + 2];
+
+			//all three outside of one plane, counted against the first such plane
+			uint16_t shared = outcodes_[i1] & outcodes_[i2] & outcodes_[i3] & kOutVolume;
+			if (shared != 0) {
+				int plane = 0;
+				while (!(shared & (1 << plane))) {
+					plane++;
+				}
+				dropped_[i / 3] = 1;
+				rejected[plane]++;
+				continue;
+			}
 
 			const short o1 = oris_[i1];
 			const short o2 = oris_[i2];
 			const short o3 = oris_[i3];
 
+			//a corner past the guard band would not fit the fixed point of the rasterizer, such triangles are clipped on their own
+			//so are those whose near or far clip would make such a corner
+			if (((outcodes_[i1] | outcodes_[i2] | outcodes_[i3]) & kOutGuard)
+				|| lerpPastGuard(i1, i2, o1, o2) || lerpPastGuard(i1, i3, o1, o3) || lerpPastGuard(i2, i3, o2, o3)) {
+				guarded_[i / 3] = 1;
+				continue;
+			}
+
+			if ((o1 != o2 || o1 != o3) && base + overts_.size() + 6 > limit) {
+				dropped_[i / 3] = 1;
+				overflow++;
+				continue;
+			}
+
 			allocLerpVertex(i1, i2, o1, o2);
 			allocLerpVertex(i1, i3, o1, o3);
 			allocLerpVertex(i2, i3, o2, o3);
 		}
 
+		if (overflow != 0) {
+			profiler_->count("Clip Index Overflow", overflow);
+		}
+
+		static const char* const kRejectedNames[6] = {
+			"Clip Rejected Left", "Clip Rejected Right", "Clip Rejected Bottom",
+			"Clip Rejected Top", "Clip Rejected Near", "Clip Rejected Far"
+		};
+		for (size_t plane = 0; plane != rejected.size(); plane++) {
+			if (rejected[plane] != 0) {
+				profiler_->count(kRejectedNames[plane], rejected[plane]);
+			}
+		}
+
 		//ֵ
-		auto calc_lerp = [&](const std::pair<size_t, size_t>& mm) {
-			size_t i1 = mm.first;
-			size_t i2 = mm.second;
+		//positions and varyings with the same weights, the positions from the stream
+		auto lerp_vertex = [&](I i1, I i2, I i3, const std::vector<float>& ds) {
+			overts_[i3 - base].varyings = SignedDistanceLerp(iverts[i1].varyings, iverts[i2].varyings, ds[i1], ds[i2]);
+			opositions_[i3 - base] = SignedDistanceLerp(position(i1), position(i2), ds[i1], ds[i2]);
+		};
+
+		auto calc_lerp = [&](const std::pair<I, I>& mm) {
+			I i1 = mm.first;
+			I i2 = mm.second;
 
-			std::map<short, size_t>& dict = lerpdict_[i1][i2];
+			std::map<short, I>& dict = lerpdict_[i1][i2];
 			if (dict.size() == 1) {
 				short oo = dict.begin()->first;
-				size_t i3 = dict.begin()->second;
+				I i3 = dict.begin()->second;
 				const std::vector<float>* pds = (oo == kTooNear ? &neards_ : &fards_);
 
-				overts_[i3] = SignedDistanceLerp(overts_[i1], overts_[i2], (*pds)[i1], (*pds)[i2]);
+				lerp_vertex(i1, i2, i3, *pds);
 			}
 			else if (dict.size() == 2) {
-				size_t i3 = dict[kTooNear];
-				size_t i4 = dict[kTooFar];
+				I i3 = dict[kTooNear];
+				I i4 = dict[kTooFar];
 
-				overts_[i3] = SignedDistanceLerp(overts_[i1], overts_[i2], neards_[i1], neards_[i2]);
-				overts_[i4] = SignedDistanceLerp(overts_[i1], overts_[i2], fards_[i1], fards_[i2]);
+				lerp_vertex(i1, i2, i3, neards_);
+				lerp_vertex(i1, i2, i4, fards_);
 			}
 		};
 
@@ -195,20 +342,20 @@ private:
 	}
 
 	void allocTriangle(size_t i) {
-		const size_t i1 = iprims_->indexs_[i];
-		const size_t i2 = iprims_->indexs_[i + 1];
-		const size_t i3 = iprims_->indexs_[i + 2];
+		if (dropped_[i / 3]) {
+			return;
+		}
 
-		const SoftVertex<A, V>& v1 = iprims_->verts_[i1];
-		const SoftVertex<A, V>& v2 = iprims_->verts_[i2];
-		const SoftVertex<A, V>& v3 = iprims_->verts_[i3];
+		const I i1 = iprims_->indexs_[i];
+		const I i2 = iprims_->indexs_[i + 1];
+		const I i3 = iprims_->indexs_[i + 2];
 
 		const short o1 = oris_[i1];
 		const short o2 = oris_[i2];
 		const short o3 = oris_[i3];
 
 		//޳
-		if (refuse_back_ && !IsCounterClockwise(v1.pos, v2.pos, v3.pos)) {
+		if (refuse_back_ && !IsCounterClockwise(position(i1), position(i2), position(i3))) {
 			return;
 		}
 
@@ -236,13 +383,13 @@ private:
 		//S-3 ÿ㶼ڲͬ
 		//	S-3.1 ֵõĸ㣬ΣֳΣ
 
-		std::array<size_t, 3> tri_index = { i1, i2, i3 };
-		size_t inf = (std::numeric_limits<size_t>::max)();
+		std::array<I, 3> tri_index = { i1, i2, i3 };
+		I inf = (std::numeric_limits<I>::max)();
 
 		if (max_count == 3) {
 			//S-1.1
 			if (counter[kOK] == 3) {
-				tridict_[i].push_back(oindexs_.size());
+				tridict_[i].push_back((uint32_t)oindexs_.size());
 				oindexs_.insert(oindexs_.end(), 3, inf);
 			}
 
@@ -252,64 +399,150 @@ private:
 		else if (max_count == 2) {
 			//S-2.1
 			if (counter[kOK] == 1) {
-				tridict_[i].push_back(oindexs_.size());
+				tridict_[i].push_back((uint32_t)oindexs_.size());
 				oindexs_.insert(oindexs_.end(), 3, inf);
 			}
 			//S-2.2
 			else if (counter[kOK] == 2) {
-				tridict_[i].push_back(oindexs_.size());
+				tridict_[i].push_back((uint32_t)oindexs_.size());
 				oindexs_.insert(oindexs_.end(), 3, inf);
 
-				tridict_[i].push_back(oindexs_.size());
+				tridict_[i].push_back((uint32_t)oindexs_.size());
 				oindexs_.insert(oindexs_.end(), 3, inf);
 			}
 			//S-2.3
 			else if (counter[kOK] == 0) {
-				tridict_[i].push_back(oindexs_.size());
+				tridict_[i].push_back((uint32_t)oindexs_.size());
 				oindexs_.insert(oindexs_.end(), 3, inf);
 
-				tridict_[i].push_back(oindexs_.size());
+				tridict_[i].push_back((uint32_t)oindexs_.size());
 				oindexs_.insert(oindexs_.end(), 3, inf);
 			}
 		}
 		else if (max_count == 1) {
 			//S - 3.1
-			tridict_[i].push_back(oindexs_.size());
+			tridict_[i].push_back((uint32_t)oindexs_.size());
 			oindexs_.insert(oindexs_.end(), 3, inf);
 
-			tridict_[i].push_back(oindexs_.size());
+			tridict_[i].push_back((uint32_t)oindexs_.size());
 			oindexs_.insert(oindexs_.end(), 3, inf);
 
-			tridict_[i].push_back(oindexs_.size());
+			tridict_[i].push_back((uint32_t)oindexs_.size());
 			oindexs_.insert(oindexs_.end(), 3, inf);
 		}
 	}
 
-	void copyOIndex3(size_t i1, size_t i2, size_t i3, size_t pos) {
+	//clips the triangle at i against the near, far and guard band planes, each one some corner of the polygon so far is outside of
+	//the corners it makes go to overts_ and opositions_, a fan over the polygon straight to oindexs_
+	//returns false when the index type has no room for them
+	bool clipGuardBand(size_t i) {
+		const std::vector<SoftVertex<A, V> >& iverts = iprims_->verts_;
+		const size_t limit = (std::numeric_limits<I>::max)();
+
+		const I i1 = iprims_->indexs_[i];
+		const I i2 = iprims_->indexs_[i + 1];
+		const I i3 = iprims_->indexs_[i + 2];
+
+		//޳
+		if (refuse_back_ && !IsCounterClockwise(position(i1), position(i2), position(i3))) {
+			return true;
+		}
+
+		//each plane adds at most one corner, a triangle ends with nine
+		std::array<GuardCorner, 9> poly, next;
+		int n = 3;
+		poly[0] = { i1, position(i1), iverts[i1].varyings };
+		poly[1] = { i2, position(i2), iverts[i2].varyings };
+		poly[2] = { i3, position(i3), iverts[i3].varyings };
+
+		//near first, past it every corner has w > 0 and the guard planes hold
+		for (int plane = 0; plane != 6; plane++) {
+			std::array<float, 9> ds;
+			bool outside = false;
+			for (int k = 0; k != n; k++) {
+				ds[k] = guardDistance(poly[k].pos, plane);
+				outside = outside || ds[k] < 0;
+			}
+			if (!outside) {
+				continue;
+			}
+
+			int m = 0;
+			for (int k = 0; k != n; k++) {
+				const GuardCorner& c1 = poly[k];
+				const GuardCorner& c2 = poly[(k + 1) % n];
+				float d1 = ds[k];
+				float d2 = ds[(k + 1) % n];
+
+				if (d1 >= 0) {
+					next[m++] = c1;
+				}
+				if ((d1 >= 0) != (d2 >= 0)) {
+					GuardCorner& c = next[m++];
+					c.index = (I)limit;
+					c.pos = SignedDistanceLerp(c1.pos, c2.pos, d1, d2);
+					c.varyings = SignedDistanceLerp(c1.varyings, c2.varyings, d1, d2);
+				}
+			}
+
+			poly.swap(next);
+			n = m;
+			if (n < 3) {
+				return true;
+			}
+		}
+
+		size_t made = 0;
+		for (int k = 0; k != n; k++) {
+			made += (poly[k].index == (I)limit ? 1 : 0);
+		}
+		if (iverts.size() + overts_.size() + made > limit) {
+			return false;
+		}
+
+		for (int k = 0; k != n; k++) {
+			if (poly[k].index == (I)limit) {
+				poly[k].index = (I)(iverts.size() + overts_.size());
+				overts_.push_back(SoftVertex<A, V>());
+				overts_.back().varyings = poly[k].varyings;
+				opositions_.push_back(poly[k].pos);
+			}
+		}
+
+		for (int k = 1; k + 1 < n; k++) {
+			oindexs_.push_back(poly[0].index);
+			oindexs_.push_back(poly[k].index);
+			oindexs_.push_back(poly[k + 1].index);
+		}
+
+		return true;
+	}
+
+	void copyOIndex3(I i1, I i2, I i3, uint32_t pos) {
 		oindexs_[pos] = i1;
 		oindexs_[pos + 1] = i2;
 		oindexs_[pos + 2] = i3;
 	}
 
 	void clipTriangle(size_t itir) {
-		size_t i = itir * 3;
+		if (dropped_[itir] || guarded_[itir]) {
+			return;
+		}
 
-		const size_t i1 = iprims_->indexs_[i];
-		const size_t i2 = iprims_->indexs_[i + 1];
-		const size_t i3 = iprims_->indexs_[i + 2];
+		size_t i = itir * 3;
 
-		const SoftVertex<A, V>& v1 = iprims_->verts_[i1];
-		const SoftVertex<A, V>& v2 = iprims_->verts_[i2];
-		const SoftVertex<A, V>& v3 = iprims_->verts_[i3];
+		const I i1 = iprims_->indexs_[i];
+		const I i2 = iprims_->indexs_[i + 1];
+		const I i3 = iprims_->indexs_[i + 2];
 
 		const short o1 = oris_[i1];
 		const short o2 = oris_[i2];
 		const short o3 = oris_[i3];
 
-		const std::vector<size_t>& dict = tridict_[i];
+		const std::vector<uint32_t>& dict = tridict_[i];
 		
 		//޳
-		if (refuse_back_ && !IsCounterClockwise(v1.pos, v2.pos, v3.pos)) {
+		if (refuse_back_ && !IsCounterClockwise(position(i1), position(i2), position(i3))) {
 			return;
 		}
 
@@ -337,7 +570,7 @@ private:
 		//S-3 ÿ㶼ڲͬ
 		//	S-3.1 ֵõĸ㣬ΣֳΣ
 
-		std::array<size_t, 3> tri_index = { i1, i2, i3 };
+		std::array<I, 3> tri_index = { i1, i2, i3 };
 
 		if (max_count == 3) {
 			//S-1.1
@@ -359,8 +592,8 @@ private:
 				short oo = (o1 != kOK ? o1 : (o2 != kOK ? o2 : o3));
 
 				//ֵ
-				size_t lerp_v2 = lerpIndex(tri_index[0], tri_index[1], oo);
-				size_t lerp_v3 = lerpIndex(tri_index[0], tri_index[2], oo);
+				I lerp_v2 = lerpIndex(tri_index[0], tri_index[1], oo);
+				I lerp_v3 = lerpIndex(tri_index[0], tri_index[2], oo);
 
 				//
 				copyOIndex3(tri_index[0], lerp_v2, lerp_v3, dict[0]);
@@ -375,8 +608,8 @@ private:
 				short oo = (o1 != kOK ? o1 : (o2 != kOK ? o2 : o3));
 
 				//ֵ
-				size_t lerp_v2 = lerpIndex(tri_index[0], tri_index[1], oo);
-				size_t lerp_v3 = lerpIndex(tri_index[0], tri_index[2], oo);
+				I lerp_v2 = lerpIndex(tri_index[0], tri_index[1], oo);
+				I lerp_v3 = lerpIndex(tri_index[0], tri_index[2], oo);
 
 				//Ϊ [lerp_v2, v2, v3, lerp_v3]
 				//Ϊ [lerp_v2, v2, v3] [lerp_v2, v3, lerp_v3]
@@ -396,10 +629,10 @@ private:
 				short o_two = (o_one == kTooFar ? kTooNear : kTooFar);
 
 				//ֵ
-				size_t lerp_v2_one = lerpIndex(tri_index[0], tri_index[1], o_one);
-				size_t lerp_v3_one = lerpIndex(tri_index[0], tri_index[2], o_one);
-				size_t lerp_v2_two = lerpIndex(tri_index[0], tri_index[1], o_two);
-				size_t lerp_v3_two = lerpIndex(tri_index[0], tri_index[2], o_two);
+				I lerp_v2_one = lerpIndex(tri_index[0], tri_index[1], o_one);
+				I lerp_v3_one = lerpIndex(tri_index[0], tri_index[2], o_one);
+				I lerp_v2_two = lerpIndex(tri_index[0], tri_index[1], o_two);
+				I lerp_v3_two = lerpIndex(tri_index[0], tri_index[2], o_two);
 
 				//Ϊ [lerp_v2_one, lerp_v2_two, lerp_v3_two, lerp_v3_one]
 				//Ϊ [lerp_v2_one, lerp_v2_two, lerp_v3_two] [lerp_v2_one, lerp_v3_two, lerp_v3_one]
@@ -424,10 +657,10 @@ private:
 			short o3 = tri_o[2];
 
 			//ֵ
-			size_t lerp_v01 = lerpIndex(tri_index[0], tri_index[1], o2);
-			size_t lerp_v02 = lerpIndex(tri_index[0], tri_index[2], o3);
-			size_t lerp_v12_1 = lerpIndex(tri_index[1], tri_index[2], o2);
-			size_t lerp_v12_2 = lerpIndex(tri_index[1], tri_index[2], o3);
+			I lerp_v01 = lerpIndex(tri_index[0], tri_index[1], o2);
+			I lerp_v02 = lerpIndex(tri_index[0], tri_index[2], o3);
+			I lerp_v12_1 = lerpIndex(tri_index[1], tri_index[2], o2);
+			I lerp_v12_2 = lerpIndex(tri_index[1], tri_index[2], o3);
 
 			//Ϊ [v1, lerp_v01, lerp_v12_1, lerp_v12_2, lerp_v02]
 			//Ϊ [v1, lerp_v01, lerp_v12_1] [v1, lerp_v12_1, lerp_v12_2] [v1, lerp_v12_2, lerp_v02]
@@ -442,8 +675,23 @@ private:
 	void computeClipedTriangle() {
 		tridict_.resize(iprims_->indexs_.size());
 
+		//the guard band triangles are clipped here, on this thread, the others only get their output reserved
+		int guarded = 0, overflow = 0;
 		for (size_t i = 0; i + 2 < iprims_->indexs_.size(); i += 3) {
-			allocTriangle(i);
+			if (guarded_[i / 3]) {
+				guarded++;
+				overflow += (clipGuardBand(i) ? 0 : 1);
+			}
+			else {
+				allocTriangle(i);
+			}
+		}
+
+		if (guarded != 0) {
+			profiler_->count("Clip Guard Band", guarded);
+		}
+		if (overflow != 0) {
+			profiler_->count("Clip Index Overflow", overflow);
 		}
 
 		auto clip_tri = [&](size_t itir) {
@@ -454,21 +702,27 @@ private:
 	}
 
 private:
-	SoftPrimitiveList<A, V>* iprims_;
+	SoftPrimitiveList<A, V, I>* iprims_;
 	Profiler* profiler_;
 	bool refuse_back_;
+	float guard_;//the guard band in units of w
 
 	std::vector<short> oris_;
+	std::vector<uint16_t> outcodes_;
 	std::vector<float> neards_;
 	std::vector<float> fards_;
 
-	std::vector<std::pair<size_t, size_t> > lerps_;
-	std::map<size_t, std::map<size_t, std::map<short, size_t> > > lerpdict_;//[v1, [v2, [flag, vlerp]]]
+	std::vector<std::pair<I, I> > lerps_;
+	std::map<I, std::map<I, std::map<short, I> > > lerpdict_;//[v1, [v2, [flag, vlerp]]]
+
+	std::vector<uint8_t> dropped_;//per triangle, rejected by the outcodes or out of index room
+	std::vector<uint8_t> guarded_;//per triangle, a corner past the guard band
 
-	std::vector<std::vector<size_t> > tridict_;//[tri_index, [cliped_tri_index]]
+	std::vector<std::vector<uint32_t> > tridict_;//[tri_index, [cliped_tri_index]], offsets into oindexs_
 
-	std::vector<SoftVertex<A, V> > overts_;
-	std::vector<size_t> oindexs_;
+	std::vector<SoftVertex<A, V> > overts_;//only the vertices created by clipping
+	std::vector<Vector4f> opositions_;//and their clip positions
+	std::vector<I> oindexs_;
 };
 
 
@@ -0,0 +1,215 @@
+#pragma once
+#include "Core/MathAndGeometry.h"
+#include <algorithm>
+#include <vector>
+#include <array>
+#include <math.h>
+#include <assert.h>
+
+
+SHAKURAS_BEGIN;
+
+
+//a run of triangles in SoftPrimitiveList::indexs_ that is culled as a whole
+//the bounds are in the space of the vertex positions, before the vertex shader
+struct SoftCluster {
+	size_t index_start, index_count;
+	Vector3f center;
+	float radius;
+	Vector3f cone_axis;//average front face normal
+	float cone_cutoff;//sine of the cone's half angle, 1 when the faces spread over a hemisphere
+};
+
+
+//what SoftGeometryStage needs from a uniform list to cull clusters, specialize it to turn culling on
+//mvp must map the positions in the primitive list to clip space as the vertex shader does
+template<class UL>
+struct SoftClusterCullTraits {
+	static const bool enabled = false;
+	static Matrix44f mvp(const UL&) { return Matrix44f(); }
+};
+
+
+const size_t kClusterMinTriangles = 64;
+const size_t kClusterMaxTriangles = 128;
+
+
+//the side IsCounterClockwise keeps, zero for degenerate triangles
+inline Vector3f FrontFaceNormal(const Vector3f& p0, const Vector3f& p1, const Vector3f& p2) {
+	Vector3f n = CrossProduct3(p1 - p0, p2 - p0);
+	float len = Length3(n);
+	return (len > 0.0f ? n / len : Vector3f());
+}
+
+
+template<class P>
+SoftCluster ComputeCluster(const P& prims, size_t tri_start, size_t tri_end) {
+	SoftCluster cluster;
+	cluster.index_start = tri_start * 3;
+	cluster.index_count = (tri_end - tri_start) * 3;
+
+	auto position = [&](size_t i) {
+		return prims.positions_.vector4(prims.indexs_[i]).xyz();
+	};
+
+	//box center, tighter than the centroid for uneven tessellation
+	Vector3f lo = position(cluster.index_start), hi = lo;
+	for (size_t i = cluster.index_start; i != cluster.index_start + cluster.index_count; i++) {
+		Vector3f p = position(i);
+		lo.set((std::min)(lo.x, p.x), (std::min)(lo.y, p.y), (std::min)(lo.z, p.z));
+		hi.set((std::max)(hi.x, p.x), (std::max)(hi.y, p.y), (std::max)(hi.z, p.z));
+	}
+	cluster.center = (lo + hi) * 0.5f;
+
+	float radius2 = 0.0f;
+	for (size_t i = cluster.index_start; i != cluster.index_start + cluster.index_count; i++) {
+		Vector3f d = position(i) - cluster.center;
+		radius2 = (std::max)(radius2, DotProduct3(d, d));
+	}
+	cluster.radius = sqrtf(radius2);
+
+	Vector3f axis;
+	for (size_t t = tri_start; t != tri_end; t++) {
+		axis = axis + FrontFaceNormal(position(t * 3), position(t * 3 + 1), position(t * 3 + 2));
+	}
+
+	cluster.cone_axis = Vector3f();
+	cluster.cone_cutoff = 1.0f;
+	if (Length3(axis) == 0.0f) {
+		return cluster;
+	}
+	Normalize3(axis);
+
+	float min_dot = 1.0f;
+	for (size_t t = tri_start; t != tri_end; t++) {
+		Vector3f n = FrontFaceNormal(position(t * 3), position(t * 3 + 1), position(t * 3 + 2));
+		if (Length3(n) != 0.0f) {
+			min_dot = (std::min)(min_dot, DotProduct3(n, axis));
+		}
+	}
+
+	cluster.cone_axis = axis;
+	if (min_dot > 0.0f) {
+		cluster.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+	}
+
+	return cluster;
+}
+
+
+//groups consecutive triangles, best on lists in vertex cache order where neighbours stay together
+//a cluster ends at kClusterMaxTriangles, or past kClusterMinTriangles where the faces turn away
+//the clusters cover all of indexs_, rebuild them whenever the triangles or positions_ change
+template<class P>
+void BuildClusters(P& prims) {
+	prims.ensurePositions();
+	assert(prims.positions_.size() == prims.verts_.size());
+	prims.clusters_.clear();
+
+	auto position = [&](size_t i) {
+		return prims.positions_.vector4(prims.indexs_[i]).xyz();
+	};
+
+	size_t tri_count = prims.indexs_.size() / 3;
+	size_t start = 0;
+	Vector3f normal_sum;
+	for (size_t t = 0; t != tri_count; t++) {
+		Vector3f n = FrontFaceNormal(position(t * 3), position(t * 3 + 1), position(t * 3 + 2));
+
+		size_t count = t - start;
+		if (count == kClusterMaxTriangles || (count >= kClusterMinTriangles && DotProduct3(n, normal_sum) < 0.5f * Length3(normal_sum))) {
+			prims.clusters_.push_back(ComputeCluster(prims, start, t));
+			start = t;
+			normal_sum = Vector3f();
+		}
+		normal_sum = normal_sum + n;
+	}
+
+	if (start != tri_count) {
+		prims.clusters_.push_back(ComputeCluster(prims, start, tri_count));
+	}
+}
+
+
+//clip volume planes in the space of the positions: w+x, w-x, w+y, w-y, z, w-z, with unit normals
+inline void ClusterCullPlanes(const Matrix44f& mvp, std::array<Vector4f, 6>& planes) {
+	auto column = [&](int j) {
+		return Vector4f(mvp.m[0][j], mvp.m[1][j], mvp.m[2][j], mvp.m[3][j]);
+	};
+
+	planes[0] = column(3) + column(0);
+	planes[1] = column(3) - column(0);
+	planes[2] = column(3) + column(1);
+	planes[3] = column(3) - column(1);
+	planes[4] = column(2);
+	planes[5] = column(3) - column(2);
+
+	for (auto i = planes.begin(); i != planes.end(); i++) {
+		float len = Length3(*i);
+		if (len > 0.0f) {
+			*i = *i / len;
+		}
+	}
+}
+
+
+//the point that maps to x = y = w = 0, false for a parallel projection
+inline bool ClusterEye(const Matrix44f& mvp, Vector3f& eye) {
+	const int cols[3] = { 0, 1, 3 };
+
+	float a[3][3], b[3];
+	for (int r = 0; r != 3; r++) {
+		for (int c = 0; c != 3; c++) {
+			a[r][c] = mvp.m[c][cols[r]];
+		}
+		b[r] = -mvp.m[3][cols[r]];
+	}
+
+	auto det3 = [](const float m[3][3]) {
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	};
+
+	float det = det3(a);
+	if (fabsf(det) < 1e-12f) {
+		return false;
+	}
+
+	//Cramer's rule
+	float p[3];
+	for (int c = 0; c != 3; c++) {
+		float ac[3][3];
+		for (int r = 0; r != 3; r++) {
+			for (int k = 0; k != 3; k++) {
+				ac[r][k] = (k == c ? b[r] : a[r][k]);
+			}
+		}
+		p[c] = det3(ac) / det;
+	}
+
+	eye.set(p[0], p[1], p[2]);
+	return true;
+}
+
+
+inline bool ClusterVisible(const SoftCluster& cluster, const std::array<Vector4f, 6>& planes, bool cone, const Vector3f& eye) {
+	for (auto i = planes.begin(); i != planes.end(); i++) {
+		if (DotProduct3(cluster.center, i->xyz()) + i->w < -cluster.radius) {
+			return false;
+		}
+	}
+
+	//every face of the cluster looks away from the eye
+	if (cone) {
+		Vector3f view = cluster.center - eye;
+		if (DotProduct3(view, cluster.cone_axis) >= cluster.cone_cutoff * Length3(view) + cluster.radius) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+SHAKURAS_END;
\ No newline at end of file
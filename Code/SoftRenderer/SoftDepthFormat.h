@@ -0,0 +1,100 @@
+#pragma once
+#include "Core/MathAndGeometry.h"
+#include <stdint.h>
+
+
+SHAKURAS_BEGIN;
+
+
+//depth formats of SoftRasterizerStage, data_t is what the depth buffer stores
+//z is interpolated as float in every format, its 24 bit mantissa covers unorm24 and unorm16 alike
+//data() quantizes a z in [0, 1], less() is the depth test, merge() is what a passing fragment writes
+
+//float - z
+class DepthFormatF32 {
+public:
+	typedef float data_t;
+
+	static inline float scalar(float d) {
+		return d;
+	}
+
+	static inline float data(float z) {
+		return z;
+	}
+
+	static inline bool less(float z, float d) {
+		return z < d;
+	}
+
+	static inline float merge(float z, float d) {
+		return z;
+	}
+
+	static inline float clean() {
+		return 1.0f;
+	}
+};
+
+
+//uint16_t - z * 65535
+class DepthFormatU16 {
+public:
+	typedef uint16_t data_t;
+
+	static inline float scalar(uint16_t d) {
+		return d / 65535.0f;
+	}
+
+	static inline uint16_t data(float z) {
+		z = Clamp(z, 0.0f, 1.0f);
+		return (uint16_t)(z * 65535.0f + 0.5f);
+	}
+
+	static inline bool less(uint16_t z, uint16_t d) {
+		return z < d;
+	}
+
+	static inline uint16_t merge(uint16_t z, uint16_t d) {
+		return z;
+	}
+
+	static inline float clean() {
+		return 1.0f;
+	}
+};
+
+
+//uint32_t - z * 16777215 in the low 24 bits, stencil in the high 8 bits
+//the stencil is left as cleared, merge() keeps it
+class DepthFormatU24S8 {
+public:
+	typedef uint32_t data_t;
+
+	static const uint32_t kDepthMask = 0x00ffffff;
+
+	static inline float scalar(uint32_t d) {
+		return (float)((d & kDepthMask) / 16777215.0);
+	}
+
+	//in double, a float product would round before the + 0.5
+	static inline uint32_t data(float z) {
+		z = Clamp(z, 0.0f, 1.0f);
+		return (uint32_t)(z * 16777215.0 + 0.5);
+	}
+
+	static inline bool less(uint32_t z, uint32_t d) {
+		return z < (d & kDepthMask);
+	}
+
+	static inline uint32_t merge(uint32_t z, uint32_t d) {
+		return (d & ~kDepthMask) | z;
+	}
+
+	static inline float clean() {
+		return 1.0f;
+	}
+};
+
+
+SHAKURAS_END;
\ No newline at end of file
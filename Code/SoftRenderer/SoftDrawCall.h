@@ -7,10 +7,10 @@
 SHAKURAS_BEGIN;
 
 
-template<class UL, class A, class V>
+template<class UL, class A, class V, class I = uint32_t>
 struct SoftDrawCall {
 	UL uniforms;
-	SoftPrimitiveList<A, V> prims;
+	SoftPrimitiveList<A, V, I> prims;
 };
 
 
@@ -1,13 +1,29 @@
 #pragma once
 #include "SoftClipper.h"
+#include "SoftVertexStream.h"
 #include "Core/Profiler.h"
+#include <type_traits>
 #include <ppl.h>
 
 
 SHAKURAS_BEGIN;
 
 
-template<class UL, class A, class V, class VS>
+//true when VS has processBatch(const UL&, VERT* verts, size_t count), which shades a run of vertices
+//at once and can hoist what it derives from the uniforms, else process(const UL&, VERT&) is called per vertex
+template<class VS, class UL, class VERT>
+struct SoftHasProcessBatch {
+	template<class T>
+	static auto test(int) -> decltype(std::declval<T&>().processBatch(std::declval<const UL&>(), (VERT*)nullptr, size_t(0)), std::true_type());
+
+	template<class T>
+	static std::false_type test(...);
+
+	static const bool value = decltype(test<VS>(0))::value;
+};
+
+
+template<class UL, class A, class V, class VS, class I = uint32_t>
 class SoftGeometryStage {
 public:
 	void initialize(float w, float h, Profiler& profiler) {
@@ -17,28 +33,28 @@ public:
 		refuse_back_ = true;
 	}
 
-	void process(SoftDrawCall<UL, A, V>& call) {
+	void process(SoftDrawCall<UL, A, V, I>& call) {
+		call.prims.ensurePositions();
+		assert(call.prims.positions_.size() == call.prims.verts_.size());
 		profiler_->count("Geo-Triangle Count", (int)call.prims.indexs_.size() / 3);
 
+		//clusters out of the frustum or facing away are dropped before any of their vertices is shaded
+		bool culled = cullClusters(call);
+
 		//vertex sharding
 		//geometry shardingδʵ
 		//projection transform
-		auto vert_geom_sharding_and_proj = [&](SoftVertex<A, V>& vert) {
-			VS().process(call.uniforms, vert);
-		};
-
-		profiler_->count("Vert-Sharder Excuted", (int)call.prims.verts_.size());
-		Concurrency::parallel_for_each(call.prims.verts_.begin(), call.prims.verts_.end(), vert_geom_sharding_and_proj);
+		//one pass shades each vertex, classifies it for the clipper and computes its screen position
+		profiler_->count("Vert-Sharder Excuted", (int)(culled ? shaded_count_ : call.prims.verts_.size()));
+		clipper_.reset(call.prims, *profiler_, refuse_back_, width_, height_);
+		shade(call, culled, std::integral_constant<bool, SoftVertexShaderTraits<VS>::streamed>());
 
 		//cliping
-		clipper_.reset(call.prims, *profiler_, refuse_back_);
+		size_t shaded_count = call.prims.verts_.size();
 		clipper_.process();
 
 		//screen mapping
-		auto screen_mapping = [&](SoftVertex<A, V>& vert) {
-			screenMapping(vert.pos);
-		};
-		Concurrency::parallel_for_each(call.prims.verts_.begin(), call.prims.verts_.end(), screen_mapping);
+		screenMap(call, culled, shaded_count);
 	}
 
 	void refuseBack(bool rb) {
@@ -46,6 +62,168 @@ public:
 	}
 
 private:
+	//replaces the triangles by those of the visible clusters and marks their vertices in marks_
+	//the clusters are consumed, false leaves the call untouched
+	bool cullClusters(SoftDrawCall<UL, A, V, I>& call) {
+		SoftPrimitiveList<A, V, I>& prims = call.prims;
+		if (!SoftClusterCullTraits<UL>::enabled || prims.clusters_.empty()) {
+			return false;
+		}
+
+		Matrix44f mvp = SoftClusterCullTraits<UL>::mvp(call.uniforms);
+		std::array<Vector4f, 6> planes;
+		ClusterCullPlanes(mvp, planes);
+		Vector3f eye;
+		bool cone = refuse_back_ && ClusterEye(mvp, eye);
+
+		visible_.assign(prims.clusters_.size(), 0);
+		Concurrency::parallel_for(size_t(0), prims.clusters_.size(), [&](size_t c) {
+			visible_[c] = (ClusterVisible(prims.clusters_[c], planes, cone, eye) ? 1 : 0);
+		});
+
+		indexs_.clear();
+		shaded_count_ = 0;
+		marks_.assign(prims.verts_.size(), 0);
+		int culled = 0;
+		for (size_t c = 0; c != prims.clusters_.size(); c++) {
+			if (!visible_[c]) {
+				culled++;
+				continue;
+			}
+
+			const SoftCluster& cluster = prims.clusters_[c];
+			for (size_t i = cluster.index_start; i != cluster.index_start + cluster.index_count; i++) {
+				I v = prims.indexs_[i];
+				indexs_.push_back(v);
+				if (!marks_[v]) {
+					marks_[v] = 1;
+					shaded_count_++;
+				}
+			}
+		}
+
+		profiler_->count("Cluster Count", (int)prims.clusters_.size());
+		profiler_->count("Cluster Culled", culled);
+
+		prims.indexs_.swap(indexs_);
+		prims.clusters_.clear();
+		return true;
+	}
+
+	//calls f(b, e) for every run of vertices to shade in [begin, end)
+	template<class F>
+	void forEachRun(bool culled, size_t begin, size_t end, F f) {
+		if (!culled) {
+			f(begin, end);
+			return;
+		}
+
+		size_t i = begin;
+		while (i != end) {
+			while (i != end && !marks_[i]) {
+				i++;
+			}
+			size_t run = i;
+			while (i != end && marks_[i]) {
+				i++;
+			}
+			if (run != i) {
+				f(run, i);
+			}
+		}
+	}
+
+	//shaders without the streamed trait see the position in verts[i].pos, it goes through there and back
+	void shade(SoftDrawCall<UL, A, V, I>& call, bool culled, std::false_type) {
+		std::vector<SoftVertex<A, V> >& verts = call.prims.verts_;
+		SoftVertexStream<4>& positions = call.prims.positions_;
+		call.prims.screens_.resize(verts.size());
+
+		Concurrency::parallel_for(size_t(0), verts.size(), kStreamChunk, [&](size_t begin) {
+			VS vs;
+			forEachRun(culled, begin, (std::min)(begin + kStreamChunk, verts.size()), [&](size_t b, size_t e) {
+				for (size_t i = b; i != e; i++) {
+					verts[i].pos = positions.vector4(i);
+				}
+				shadeRun(vs, call.uniforms, &verts[b], e - b, std::integral_constant<bool, SoftHasProcessBatch<VS, UL, SoftVertex<A, V> >::value>());
+				for (size_t i = b; i != e; i++) {
+					positions.setVector4(i, verts[i].pos);
+					clipper_.orientate(i);
+					screenMapping(call.prims.screens_, verts[i].pos, i);
+				}
+			});
+		});
+	}
+
+	void shadeRun(VS& vs, const UL& u, SoftVertex<A, V>* verts, size_t count, std::true_type) {
+		vs.processBatch(u, verts, count);
+	}
+
+	void shadeRun(VS& vs, const UL& u, SoftVertex<A, V>* verts, size_t count, std::false_type) {
+		for (size_t i = 0; i != count; i++) {
+			vs.process(u, verts[i]);
+		}
+	}
+
+	//positions are transformed in place in the list's stream and mapped to the screen a chunk at a time
+	//the clipper and the rasterizer read them from there, verts[i].pos is never touched
+	void shade(SoftDrawCall<UL, A, V, I>& call, bool culled, std::true_type) {
+		std::vector<SoftVertex<A, V> >& verts = call.prims.verts_;
+		SoftVertexStream<4>& positions = call.prims.positions_;
+		call.prims.screens_.resize(verts.size());
+
+		Concurrency::parallel_for(size_t(0), verts.size(), kStreamChunk, [&](size_t begin) {
+			size_t end = (std::min)(begin + kStreamChunk, verts.size());
+
+			//varyings first, they may read the positions before the transform
+			VS vs;
+			forEachRun(culled, begin, end, [&](size_t b, size_t e) {
+				vs.processVaryings(call.uniforms, positions, verts.data(), b, e);
+			});
+
+			//lanes of the vertices left out are transformed too, nothing reads them
+			size_t batch_end = (end + kStreamBatch - 1) / kStreamBatch * kStreamBatch;
+			vs.processPositions(call.uniforms, positions, positions, begin, batch_end);
+			ScreenMapStream(positions, call.prims.screens_, width_, height_, begin, batch_end);
+
+			forEachRun(culled, begin, end, [&](size_t b, size_t e) {
+				for (size_t i = b; i != e; i++) {
+					clipper_.orientate(i);
+				}
+			});
+		});
+	}
+
+	//the clipper appended the vertices it created, they are mapped here one by one
+	//varyings are divided by w here, once per vertex instead of once per triangle corner in the rasterizer
+	void screenMap(SoftDrawCall<UL, A, V, I>& call, bool culled, size_t shaded_count) {
+		std::vector<SoftVertex<A, V> >& verts = call.prims.verts_;
+		SoftVertexStream<4>& screens = call.prims.screens_;
+		Concurrency::parallel_for(size_t(0), shaded_count, kStreamChunk, [&](size_t begin) {
+			forEachRun(culled, begin, (std::min)(begin + kStreamChunk, shaded_count), [&](size_t b, size_t e) {
+				for (size_t i = b; i != e; i++) {
+					verts[i].varyings = verts[i].varyings * screens[3][i];
+				}
+			});
+		});
+
+		screens.resize(verts.size());
+		Concurrency::parallel_for(shaded_count, verts.size(), [&](size_t i) {
+			screenMapping(screens, call.prims.positions_.vector4(i), i);
+			verts[i].varyings = verts[i].varyings * screens[3][i];
+		});
+	}
+
+	void screenMapping(SoftVertexStream<4>& screens, const Vector4f& v, size_t i) {
+		Vector4f r = v;
+		screenMapping(r);
+
+		screens[0][i] = r.x;
+		screens[1][i] = r.y;
+		screens[2][i] = r.z;
+		screens[3][i] = 1.0f / r.w;
+	}
+
 	void screenMapping(Vector4f& v) {
 		float w = v.w;
 		float rhw = 1.0f / w;
@@ -64,7 +242,10 @@ private:
 	float width_, height_;
 	bool refuse_back_;
 	Profiler* profiler_;
-	SoftClipper<A, V> clipper_;
+	SoftClipper<A, V, I> clipper_;
+	std::vector<uint8_t> visible_, marks_;//per cluster, per vertex
+	std::vector<I> indexs_;
+	size_t shaded_count_;
 };
 
 
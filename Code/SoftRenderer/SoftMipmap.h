@@ -3,11 +3,18 @@
 #include "SoftSurface.h"
 #include <vector>
 #include <math.h>
+#include <atomic>
+#include <memory>
+#include <ppl.h>
 
 
 SHAKURAS_BEGIN;
 
 
+//all levels live in one aligned buffer, levels_ holds the precomputed view of each level
+//the levels are stored either as data_t or as BC1/BC3 blocks, see SoftBlockFormat
+//levels finer than resident_ are still being streamed in, sampling clamps to the resident ones
+//an adopted chain lives in external storage, e.g. a mapped mip chain file, and is read-only
 template<class CF>
 class SoftMipmap {
 public:
@@ -15,62 +22,266 @@ public:
 	typedef typename CF::data_t data_t;
 	typedef typename CF::scalar_t scalar_t;
 	typedef SoftSurface<CF> surface_t;
+	typedef SoftSurfaceView<CF> level_t;
+	typedef std::vector<uint8_t, AlignedAllocator<uint8_t, kCacheLineSize> > buffer_t;
 
 public:
-	SoftMipmap() {}
+	SoftMipmap() : block_(kBlockNone), resident_(0), placeholder_texel_() {
+		placeholder_ = level_t(&placeholder_texel_, 1, 1);
+	}
+	SoftMipmap(const SoftMipmap&) = delete;
+	SoftMipmap& operator=(const SoftMipmap&) = delete;
 
 public:
-	void reset(std::shared_ptr<surface_t> surface) {
-		surfaces_.clear();
+	void reset(const surface_t& surface, int block = kBlockNone) {
+		//the chain is always built uncompressed, then encoded level by level
+		buffer_t raw;
+		std::vector<level_t> raw_levels;
+		allocate(surface.width(), surface.height(), kBlockNone, raw, raw_levels);
+
+		keepalive_.reset();
+		if (raw_levels.empty()) {
+			buffer_.clear();
+			levels_.clear();
+			block_ = kBlockNone;
+			resident_ = 0;
+			return;
+		}
+
+		std::copy_n(surface.data(), (size_t)surface.width() * surface.height(), (data_t*)raw.data());
+
+		for (size_t l = 1; l < raw_levels.size(); l++) {
+			downsample(raw_levels[l - 1], raw_levels[l]);
+		}
 
-		if (!surface) {
+		block_ = (sizeof(data_t) == sizeof(uint32_t) ? block : kBlockNone);
+		if (block_ == kBlockNone) {
+			buffer_.swap(raw);
+			levels_.swap(raw_levels);
+			resident_ = 0;
 			return;
 		}
 
-		surfaces_.push_back(surface);
+		allocate(surface.width(), surface.height(), block_, buffer_, levels_);
+		for (size_t l = 0; l < levels_.size(); l++) {
+			compress(raw_levels[l], levels_[l]);
+		}
+		resident_ = 0;
+	}
 
-		int w = (surface->width() + 1) / 2;
-		int h = (surface->height() + 1) / 2;
-		while (w > 1 || h > 1) {
-			std::shared_ptr<surface_t> next_surface = std::make_shared<surface_t>();
-			next_surface->reset(w, h);
+	//streaming: prepare() lays out the storage with no level resident, sampling returns the placeholder texel
+	//stream() then fills the levels from another thread and publishes them coarsest first
+	void prepare(int w, int h, int block = kBlockNone, data_t placeholder = data_t()) {
+		block_ = (sizeof(data_t) == sizeof(uint32_t) ? block : kBlockNone);
+		keepalive_.reset();
+		allocate(w, h, block_, buffer_, levels_);
+		placeholder_texel_ = placeholder;
+		resident_ = levelCount();
+	}
 
-			for (int x = 0; x != w; x++) {
-				int xx = x * 2;
+	void stream(const surface_t& surface) {
+		if (surface.width() != width() || surface.height() != height()) {
+			return;
+		}
 
-				for (int y = 0; y != h; y++) {
-					int yy = y * 2;
+		stream([&](data_t* level0) {
+			std::copy_n(surface.data(), (size_t)surface.width() * surface.height(), level0);
+			return true;
+		});
+	}
 
-					scalar_t c0 = surface->gets(xx, yy);
-					scalar_t c1 = surface->gets((xx + 1) % surface->width(), yy);
-					scalar_t c2 = surface->gets(xx, (yy + 1) % surface->height());
-					scalar_t c3 = surface->gets((xx + 1) % surface->width(), (yy + 1) % surface->height());
+	//fill(data_t* level0) writes width() * height() texels of level 0 in place, false leaves nothing resident
+	template<typename F>
+	void stream(F fill) {
+		if (levels_.empty() || keepalive_) {
+			return;
+		}
 
-					next_surface->sets(x, y, (c0 + c1 + c2  + c3) * 0.25f);
-				}
+		if (block_ == kBlockNone) {
+			//the chain is built fine to coarse, publishing waits for the last downsample
+			if (!fill(const_cast<data_t*>(levels_[0].data()))) {
+				return;
+			}
+			for (size_t l = 1; l < levels_.size(); l++) {
+				downsample(levels_[l - 1], levels_[l]);
 			}
+			publish(0);
+			return;
+		}
+
+		buffer_t raw;
+		std::vector<level_t> raw_levels;
+		allocate(width(), height(), kBlockNone, raw, raw_levels);
+
+		if (!fill((data_t*)raw.data())) {
+			return;
+		}
+		for (size_t l = 1; l < raw_levels.size(); l++) {
+			downsample(raw_levels[l - 1], raw_levels[l]);
+		}
+
+		//encoding dominates, so finer levels show up one by one
+		for (int l = levelCount() - 1; l >= 0; l--) {
+			compress(raw_levels[l], levels_[l]);
+			publish(l);
+		}
+	}
+
+	//bits/size is a chain laid out as this class stores it, see storage(), kept alive by keepalive
+	//only the level views are set up, false if the size does not match the layout of w x h
+	bool adopt(const void* bits, size_t size, int w, int h, int block, std::shared_ptr<void> keepalive) {
+		block = (sizeof(data_t) == sizeof(uint32_t) ? block : kBlockNone);
+
+		std::vector<std::pair<size_t, Vector2i> > table;
+		if (layout(w, h, block, table) != size || size == 0 || (uintptr_t)bits % kCacheLineSize != 0) {
+			return false;
+		}
+
+		buffer_t().swap(buffer_);
+		views((const uint8_t*)bits, table, block, levels_);
+		keepalive_ = keepalive;
+		block_ = block;
+		resident_ = 0;
+		return true;
+	}
+
+	inline int levelCount() const { return (int)levels_.size(); }
+	inline const level_t& level(int l) const {
+		int r = resident_.load(std::memory_order_acquire);
+		if (r >= levelCount()) {
+			return placeholder_;
+		}
+		return levels_[Clamp(l, r, levelCount() - 1)];
+	}
+
+	//size of level 0, valid before it is resident
+	inline int width() const { return levels_.empty() ? 1 : levels_[0].width(); }
+	inline int height() const { return levels_.empty() ? 1 : levels_[0].height(); }
 
-			surface = next_surface;
-			surfaces_.push_back(surface);
+	inline int residentLevel() const { return resident_.load(std::memory_order_acquire); }
+	inline bool resident() const { return residentLevel() == 0; }
+
+	inline int block() const { return block_; }
+	inline size_t memorySize() const { return storageSize(); }
+
+	//the whole chain, what adopt() takes back
+	inline const uint8_t* storage() const { return levels_.empty() ? nullptr : levels_[0].bits(); }
+	inline size_t storageSize() const {
+		std::vector<std::pair<size_t, Vector2i> > table;
+		return levels_.empty() ? 0 : layout(width(), height(), block_, table);
+	}
+
+private:
+	void publish(int l) {
+		int r = resident_.load(std::memory_order_relaxed);
+		while (l < r && !resident_.compare_exchange_weak(r, l, std::memory_order_release)) {}
+	}
+
+	static size_t levelBytes(int w, int h, int block) {
+		if (block == kBlockNone) {
+			return (size_t)w * h * sizeof(data_t);
+		}
+		return (size_t)((w + 3) / 4) * ((h + 3) / 4) * BlockBytes(block);
+	}
+
+	//offset/size of every level, returns the size of the whole chain
+	static size_t layout(int w, int h, int block, std::vector<std::pair<size_t, Vector2i> >& table) {
+		table.clear();
+
+		if (w <= 0 || h <= 0) {
+			return 0;
+		}
+
+		size_t total = 0;
+		for (;;) {
+			table.push_back(std::make_pair(total, Vector2i(w, h)));
+			//keep every level aligned, block rows stay within cache lines
+			total += (levelBytes(w, h, block) + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
 
 			w = (w + 1) / 2;
 			h = (h + 1) / 2;
+			if (w <= 1 && h <= 1) {
+				break;
+			}
 		}
+
+		return total;
 	}
 
-	inline int levelCount() const { return (int)surfaces_.size(); }
-	inline const surface_t& level(int l) const  {
-		if (l < 0) {
-			return *surfaces_.front();
+	static void views(const uint8_t* bits, const std::vector<std::pair<size_t, Vector2i> >& table, int block, std::vector<level_t>& levels) {
+		levels.clear();
+
+		uint32_t stamp = NextStorageStamp();
+		levels.reserve(table.size());
+		for (auto i = table.begin(); i != table.end(); i++) {
+			levels.push_back(level_t(bits + i->first, i->second.x, i->second.y, block, stamp, (int)levels.size()));
 		}
-		else if (levelCount() <= l) {
-			return *surfaces_.back();
+	}
+
+	static void allocate(int w, int h, int block, buffer_t& buffer, std::vector<level_t>& levels) {
+		//offset/size table, then one allocation for the whole chain
+		std::vector<std::pair<size_t, Vector2i> > table;
+		buffer.clear();
+		buffer.resize(layout(w, h, block, table), 0);
+		views(buffer.data(), table, block, levels);
+	}
+
+	//reads the raw texels directly, the texture cache is only for sampling
+	static void downsample(const level_t& src, const level_t& dst) {
+		const data_t* in = src.data();
+		data_t* out = const_cast<data_t*>(dst.data());
+		int sw = src.width();
+		int sh = src.height();
+
+		for (int y = 0; y != dst.height(); y++) {
+			int yy = y * 2;
+			int yy1 = (yy + 1) % sh;
+
+			for (int x = 0; x != dst.width(); x++) {
+				int xx = x * 2;
+				int xx1 = (xx + 1) % sw;
+
+				scalar_t c0 = CF::scalar(in[yy * sw + xx]);
+				scalar_t c1 = CF::scalar(in[yy * sw + xx1]);
+				scalar_t c2 = CF::scalar(in[yy1 * sw + xx]);
+				scalar_t c3 = CF::scalar(in[yy1 * sw + xx1]);
+
+				out[y * dst.width() + x] = CF::data((c0 + c1 + c2 + c3) * 0.25f);
+			}
 		}
-		return *surfaces_[l];
+	}
+
+	static void compress(const level_t& src, const level_t& dst) {
+		uint8_t* out = const_cast<uint8_t*>(dst.bits());
+		size_t bytes = BlockBytes(dst.block());
+
+		auto encode_row = [&](int by) {
+			uint8_t* row = out + by * ((src.width() + 3) / 4) * bytes;
+			for (int bx = 0; bx < (src.width() + 3) / 4; bx++) {
+				//edge blocks repeat the last row/column
+				uint32_t texels[16];
+				for (int j = 0; j != 4; j++) {
+					int y = (std::min)(by * 4 + j, src.height() - 1);
+					for (int i = 0; i != 4; i++) {
+						int x = (std::min)(bx * 4 + i, src.width() - 1);
+						texels[j * 4 + i] = (uint32_t)src.data()[y * src.width() + x];
+					}
+				}
+				EncodeBlock(dst.block(), texels, row + bx * bytes);
+			}
+		};
+
+		Concurrency::parallel_for(0, (src.height() + 3) / 4, encode_row);
 	}
 
 private:
-	std::vector<std::shared_ptr<surface_t> > surfaces_;
+	buffer_t buffer_;
+	std::shared_ptr<void> keepalive_;//owner of adopted storage, buffer_ is empty then
+	std::vector<level_t> levels_;
+	int block_;
+	std::atomic<int> resident_;
+	data_t placeholder_texel_;
+	level_t placeholder_;
 };
 
 
@@ -79,13 +290,25 @@ SHAKURAS_SHARED_PTR(SoftMipmapU32F3);
 
 
 template<class CF>
-std::shared_ptr<SoftMipmap<CF> > CreateSoftMipmap(std::shared_ptr<SoftSurface<CF> > surface) {
+std::shared_ptr<SoftMipmap<CF> > CreateSoftMipmap(std::shared_ptr<SoftSurface<CF> > surface, int block = kBlockNone) {
 	if (!surface) { 
 		return nullptr;
 	}
 
 	std::shared_ptr<SoftMipmap<CF> > mipmap = std::make_shared<SoftMipmap<CF> >();
-	mipmap->reset(surface);
+	mipmap->reset(*surface, block);
+
+	return mipmap;
+}
+
+
+//no decoding or downsampling, the levels are set up over the given storage
+template<class CF>
+std::shared_ptr<SoftMipmap<CF> > CreateSoftMipmap(const void* bits, size_t size, int w, int h, int block, std::shared_ptr<void> keepalive) {
+	std::shared_ptr<SoftMipmap<CF> > mipmap = std::make_shared<SoftMipmap<CF> >();
+	if (!mipmap->adopt(bits, size, w, h, block, keepalive)) {
+		return nullptr;
+	}
 
 	return mipmap;
 }
@@ -93,8 +316,8 @@ std::shared_ptr<SoftMipmap<CF> > CreateSoftMipmap(std::shared_ptr<SoftSurface<CF
 
 template<class CF>
 float ComputeLevel(const Vector2f& ddx, const Vector2f& ddy, const SoftMipmap<CF>& mipmap) {
-	int w = mipmap.level(0).width();
-	int h = mipmap.level(0).height();
+	int w = mipmap.width();
+	int h = mipmap.height();
 
 	Vector2f ddx_ts(ddx.x * w, ddx.y * h);
 	Vector2f ddy_ts(ddy.x * w, ddy.y * h);
@@ -186,8 +409,10 @@ void CalcAnisotropicLod(
 
 static const int MAX_ANISOTROPY = 16;
 
+//taps are spread along the major axis, at most max_aniso of them
+//trilinear blends the two nearest levels per tap and weights taps by a gaussian of their distance to the center
 template<class CF, typename AF>
-typename CF::scalar_t AnisoSampleImpl(float coordx, float coordy, size_t sample, float miplevel, float ratio, const Vector4f& long_axis, const SoftMipmap<CF>& mipmap, AF addressing) {
+typename CF::scalar_t AnisoSampleImpl(float coordx, float coordy, float miplevel, float ratio, const Vector4f& long_axis, int max_aniso, bool trilinear, const SoftMipmap<CF>& mipmap, AF addressing) {
 	bool is_mag = (miplevel < 0.0f);
 
 	if (is_mag)
@@ -195,61 +420,79 @@ typename CF::scalar_t AnisoSampleImpl(float coordx, float coordy, size_t sample,
 		return BilinearSample(coordx, coordy, mipmap.level(0), addressing);
 	}
 
-	int int_ratio = (std::min)((int)round(ratio), MAX_ANISOTROPY);
+	max_aniso = Clamp(max_aniso, 1, MAX_ANISOTROPY);
+	ratio = Clamp(ratio, 1.0f, (float)(MAX_ANISOTROPY * MAX_ANISOTROPY));
+
+	int int_ratio = (std::min)((int)round(ratio), max_aniso);
 
+	//footprint longer than the budget, fewer taps on a blurrier level
 	float miplevel_af_bias = log2(ratio / int_ratio);
-	if (miplevel_af_bias < 1.5f)
+	if ((!trilinear && miplevel_af_bias < 1.5f) || miplevel_af_bias < 0.0f)
 	{
 		miplevel_af_bias = 0.0f;
 	}
 
-	float start_relative_distance = -0.5f * (int_ratio - 1.0f);
+	float step = ratio / int_ratio;
+	float start_relative_distance = -0.5f * (int_ratio - 1.0f) * step;
 
 	float sample_coord_x = coordx + long_axis.x * start_relative_distance;
 	float sample_coord_y = coordy + long_axis.y * start_relative_distance;
 
-	int lo = (int)floor(miplevel + miplevel_af_bias);
-	int hi = lo + 1;
+	float lod = miplevel + miplevel_af_bias;
+	int lo = (int)floor(lod);
+	float frac = lod - lo;
 
-	// float frac = miplevel + miplevel_af_bias - low;
-	lo = (std::max)(lo, 0);
-	hi = (std::max)(hi, 0);
-
-	auto lo_sz = Clamp(lo, 0, mipmap.levelCount());
-	auto hi_sz = Clamp(hi, 0, mipmap.levelCount());
+	int last = mipmap.levelCount() - 1;
+	int hi = Clamp(lo + 1, 0, last);
+	lo = Clamp(lo, 0, last);
+	if (!trilinear || lo == hi)
+	{
+		frac = 0.0f;
+	}
 
-	CF::scalar_t color;
+	typedef typename CF::scalar_t scalar_t;
+	scalar_t color;
+	float weight_sum = 0.0f;
 	for (int i_sample = 0; i_sample < int_ratio; ++i_sample)
 	{
-		CF::scalar_t c0 = BilinearSample(sample_coord_x, sample_coord_y, mipmap.level(lo_sz), addressing);
+		scalar_t c0 = BilinearSample(sample_coord_x, sample_coord_y, mipmap.level(lo), addressing);
+		if (frac > 0.0f)
+		{
+			scalar_t c1 = BilinearSample(sample_coord_x, sample_coord_y, mipmap.level(hi), addressing);
+			c0 = c0 + (c1 - c0) * frac;
+		}
 
-		color = color + c0;
+		float weight = 1.0f;
+		if (trilinear && int_ratio > 1)
+		{
+			float d = (2.0f * i_sample - (int_ratio - 1)) / int_ratio;
+			weight = exp(-2.0f * d * d);
+		}
+
+		color = color + c0 * weight;
+		weight_sum += weight;
 
-		sample_coord_x += long_axis.x;
-		sample_coord_y += long_axis.y;
+		sample_coord_x += long_axis.x * step;
+		sample_coord_y += long_axis.y * step;
 	}
 
-	color = color / static_cast<float>(int_ratio);
+	color = color / weight_sum;
 
 	return color;
 }
 
 template<class CF, typename AF>
-typename CF::scalar_t AnisoSample(float u, float v, const Vector2f& ddx, const Vector2f& ddy, const SoftMipmap<CF>& mipmap, AF addressing) {
-	Vector4f size((float)mipmap.level(0).width(), (float)mipmap.level(0).height(), (float)mipmap.levelCount(), 0);
+typename CF::scalar_t AnisoSample(float u, float v, const Vector2f& ddx, const Vector2f& ddy, int max_aniso, bool trilinear, const SoftMipmap<CF>& mipmap, AF addressing) {
+	Vector4f size((float)mipmap.width(), (float)mipmap.height(), (float)mipmap.levelCount(), 0);
 
 	Vector4f ddx_vec4(ddx.x, ddx.y, 0.0f, 0.0f);
 	Vector4f ddy_vec4(ddy.x, ddy.y, 0.0f, 0.0f);
 
 	float lod, ratio;
 	Vector4f long_axis;
-	if (MAX_ANISOTROPY > 1)
-	{
-		CalcAnisotropicLod(size, ddx_vec4, ddy_vec4, 0, lod, ratio, long_axis);
-	}
+	CalcAnisotropicLod(size, ddx_vec4, ddy_vec4, 0, lod, ratio, long_axis);
 
-	return AnisoSampleImpl(u, v, 0, lod, ratio, long_axis, mipmap, addressing);
+	return AnisoSampleImpl(u, v, lod, ratio, long_axis, max_aniso, trilinear, mipmap, addressing);
 }
 
-
 SHAKURAS_END;
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "SoftMipmap.h"
 #include "SoftVertex.h"
+#include "SoftVertexStream.h"
 #include "SoftFragment.h"
 #include "SoftDrawCall.h"
 #include "SoftGeometryStage.h"
@@ -17,6 +18,7 @@ struct SoftPhongUniformList {
 	SoftMipmapU32F3Ptr texture;
 	int sample_cat;
 	int addr_cat;
+	int max_aniso;//tap budget of the anisotropic samplers
 	Vector3f ambient;
 	Vector3f diffuse;
 	Vector3f specular;
@@ -28,10 +30,18 @@ struct SoftPhongUniformList {
 	SoftPhongUniformList() {
 		sample_cat = SoftSampler::kTrilinear;
 		addr_cat = SoftSampler::kRepeat;
+		max_aniso = MAX_ANISOTROPY;
 	}
 };
 
 
+template<>
+struct SoftClusterCullTraits<SoftPhongUniformList> {
+	static const bool enabled = true;
+	static Matrix44f mvp(const SoftPhongUniformList& u) { return u.mvp_trsf; }
+};
+
+
 struct SoftPhongAttribList {
 	Vector2f uv;
 	Vector3f normal;
@@ -96,23 +106,67 @@ typedef SoftDrawCall<SoftPhongUniformList, SoftPhongAttribList, SoftPhongVarying
 
 typedef SoftPrimitiveList<SoftPhongAttribList, SoftPhongVaryingList> SoftPhongPrimitiveList;
 
+//for meshes under 64k vertices
+typedef SoftDrawCall<SoftPhongUniformList, SoftPhongAttribList, SoftPhongVaryingList, uint16_t> SoftPhongDrawCall16;
+
+typedef SoftPrimitiveList<SoftPhongAttribList, SoftPhongVaryingList, uint16_t> SoftPhongPrimitiveList16;
+
 
 class SoftPhongVertexShader {
 public:
 	void process(const SoftPhongUniformList& u, SoftPhongVertex& v) {
+		processBatch(u, &v, 1);
+	}
+
+	void processBatch(const SoftPhongUniformList& u, SoftPhongVertex* verts, size_t count) {
+		Matrix33f normal_trsf = normalTransform(u);
+		for (size_t i = 0; i != count; i++) {
+			varyings(u, normal_trsf, verts[i].pos.xyz(), verts[i]);
+			verts[i].pos = u.mvp_trsf.transform(verts[i].pos);
+		}
+	}
+
+	void processPositions(const SoftPhongUniformList& u, const SoftVertexStream<4>& in, SoftVertexStream<4>& out, size_t begin, size_t end) {
+		TransformStream(u.mvp_trsf, in, out, begin, end);
+	}
+
+	void processVaryings(const SoftPhongUniformList& u, const SoftVertexStream<4>& in, SoftPhongVertex* verts, size_t begin, size_t end) {
+		Matrix33f normal_trsf = normalTransform(u);
+		for (size_t i = begin; i != end; i++) {
+			varyings(u, normal_trsf, Vector3f(in[0][i], in[1][i], in[2][i]), verts[i]);
+		}
+	}
+
+private:
+	//normals are directions, only the upper 3x3 of the model transform applies
+	static Matrix33f normalTransform(const SoftPhongUniformList& u) {
+		Matrix33f normal_trsf;
+		for (int r = 0; r != 3; r++) {
+			for (int c = 0; c != 3; c++) {
+				normal_trsf.m[r][c] = u.model_trsf.m[r][c];
+			}
+		}
+		return normal_trsf;
+	}
+
+	static void varyings(const SoftPhongUniformList& u, const Matrix33f& normal_trsf, const Vector3f& pos, SoftPhongVertex& v) {
 		v.varyings.uv = v.attribs.uv;
 
-		v.varyings.normal = u.model_trsf.transform(v.attribs.normal.xyzw(0.0f)).xyz();
+		v.varyings.normal = normal_trsf.transform(v.attribs.normal);
 
 		v.varyings.light_dir = u.light_dir;
 
-		v.varyings.eye_dir = u.eye_pos - v.pos.xyz();
-
-		v.pos = u.mvp_trsf.transform(v.pos);
+		v.varyings.eye_dir = u.eye_pos - pos;
 	}
 };
 
 
+template<>
+struct SoftVertexShaderTraits<SoftPhongVertexShader> {
+	static const bool streamed = true;
+};
+
+
 class SoftPhongFragmentShader {
 public:
 	void process(const SoftPhongUniformList& u, SoftSampler& sampler, SoftPhongFragment& f) {
@@ -130,7 +184,7 @@ public:
 		Vector2f uv = f.varyings.uv;
 		Vector3f tc(1.0f, 1.0f, 1.0f);//Ĭϰɫ
 		if (u.texture) {
-			tc = sampler.sample(uv.x, uv.y, *u.texture, u.sample_cat, u.addr_cat);
+			tc = sampler.sample(uv.x, uv.y, *u.texture, u.sample_cat, u.addr_cat, u.max_aniso);
 		}
 		Vector3f c(tc.x * illum.x, tc.y * illum.y, tc.z * illum.z);
 
@@ -143,7 +197,9 @@ public:
 };
 
 
-typedef SoftRenderStage<SoftPhongUniformList, SoftPhongAttribList, SoftPhongVaryingList, ColorFormatU32F3, SoftPhongVertexShader, SoftPhongFragmentShader> SoftPhongRenderStage;
+typedef SoftRenderStage<SoftPhongUniformList, SoftPhongAttribList, SoftPhongVaryingList, ColorFormatU32F3, DepthFormatF32, SoftPhongVertexShader, SoftPhongFragmentShader> SoftPhongRenderStage;
+
+typedef SoftRenderStage<SoftPhongUniformList, SoftPhongAttribList, SoftPhongVaryingList, ColorFormatU32F3, DepthFormatF32, SoftPhongVertexShader, SoftPhongFragmentShader, uint16_t> SoftPhongRenderStage16;
 
 
 SHAKURAS_END;
\ No newline at end of file
@@ -1,22 +1,54 @@
 #pragma once
 #include "SoftVertex.h"
+#include "SoftCluster.h"
+#include "SoftVertexStream.h"
 #include <assert.h>
+#include <stdint.h>
 
 
 SHAKURAS_BEGIN;
 
 
-template<class A, class V> 
+//I is the index type, uint16_t halves the index traffic of meshes with few vertices
+template<class A, class V, class I = uint32_t>
 class SoftPrimitiveList {
+public:
+	typedef I index_t;
+
 public:
 	void clear() {
 		verts_.clear();
+		positions_.resize(0);
+		screens_.resize(0);
 		indexs_.clear();
+		clusters_.clear();
+	}
+
+	//positions_ from verts_[i].pos, for lists built with the positions in the vertices
+	void streamPositions() {
+		positions_.resize(verts_.size());
+		for (size_t i = 0; i != verts_.size(); i++) {
+			positions_.setVector4(i, verts_[i].pos);
+		}
+	}
+
+	//streams the positions unless positions_ already holds one per vertex, the pipeline calls it before reading them
+	//a list whose verts_[i].pos change afterwards, at the same count, calls streamPositions itself
+	void ensurePositions() {
+		if (positions_.size() != verts_.size()) {
+			streamPositions();
+		}
 	}
 
 public:
 	std::vector<SoftVertex<A, V> > verts_;
-	std::vector<size_t> indexs_;//һTriangles
+	//the positions of verts_, apart so the pipeline streams them without touching the rest of the vertices
+	//object space on input, turned into clip space in place by the geometry stage, which appends the clip vertices
+	//filled from verts_ on first use when left empty, see ensurePositions, a list copied per frame streams them once up front
+	SoftVertexStream<4> positions_;
+	SoftVertexStream<4> screens_;//x, y, z / w, 1 / w, written by the geometry stage for the rasterizer
+	std::vector<I> indexs_;//һTriangles
+	std::vector<SoftCluster> clusters_;//optional, see BuildClusters
 };
 
 
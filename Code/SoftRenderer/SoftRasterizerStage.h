@@ -3,268 +3,268 @@
 #include "SoftVertex.h"
 #include "SoftSampler.h"
 #include "SoftColorFormat.h"
+#include "SoftDepthFormat.h"
+#include "SoftTiledBuffer.h"
 #include "Core/Profiler.h"
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
 #include <ppl.h>
 
 
 SHAKURAS_BEGIN;
 
 
-struct Edge {
-	Vector4f v1, v2;
+template<class UL, class FRAG, class FS>
+class TileShader {
+public:
+	void process(const UL& u, std::array<FRAG, 4>& tile) {
+		sampler_.ddx_ = TexCoord(tile[1].varyings) - TexCoord(tile[0].varyings);
+		sampler_.ddy_ = TexCoord(tile[2].varyings) - TexCoord(tile[0].varyings);
+		for (int i = 0; i != 4; i++) {
+			if (0.0f < tile[i].weight) {
+				fragshader_.process(u, sampler_, tile[i]);
+			}
+		}
+	}
+
+public:
+	SoftSampler sampler_;
+	FS fragshader_;
 };
 
 
-inline Vector4f Lerp(const Edge& edge, float y) {
-	return edge.v1 + (edge.v2 - edge.v1) * ((y - edge.v1.y) / (edge.v2.y - edge.v1.y));
-}
+//bits below the pixel in the fixed-point screen positions of the triangle setup, 28.4
+const int kSubPixelBits = 4;
+const int kSubPixelOne = 1 << kSubPixelBits;
 
 
-struct Trapezoid {
-	float top, bottom;
-	Edge left, right;
-};
+//a screen triangle in fixed point, with the pixels whose centers its bounding box holds
+//the vertices are ordered so the edge functions are positive inside, a sample on an edge is covered by the top and left ones only
+//so a pixel center on an edge shared by two triangles is covered by exactly one of them
+class TriangleSetup {
+public:
+	enum {
+		kVisible,
+		kDegenerate,//zero area
+		kEmpty,//no pixel center in the bounding box
+		kOutOfRange,//past kSubPixelRange, the guard band of the clipper keeps visible triangles short of it
+	};
 
+	int reset(const Vector4f& p0, const Vector4f& p1, const Vector4f& p2, int width, int height) {
+		const Vector4f* p[3] = { &p0, &p1, &p2 };
+		for (int i = 0; i != 3; i++) {
+			if (!(fabsf(p[i]->x) < kSubPixelRange && fabsf(p[i]->y) < kSubPixelRange)) {
+				return kOutOfRange;
+			}
+			x_[i] = (int)floorf(p[i]->x * kSubPixelOne + 0.5f);
+			y_[i] = (int)floorf(p[i]->y * kSubPixelOne + 0.5f);
+		}
 
-template<class A, class V>
-inline Vector4f XYZRhw(const SoftVertex<A, V>& v) {
-	return Vector4f(v.pos.x, v.pos.y, v.pos.z, v.rhw);
-}
-
-
-template<class A, class V>
-int SpliteTrapezoid(const SoftVertex<A, V>& v0, const SoftVertex<A, V>& v1, const SoftVertex<A, V>& v2, std::vector<Trapezoid>& traps) {
-	const SoftVertex<A, V>* p1 = &v0;
-	const SoftVertex<A, V>* p2 = &v1;
-	const SoftVertex<A, V>* p3 = &v2;
-	float k, x;
-
-	if (p1->pos.y > p2->pos.y) std::swap(p1, p2);
-	if (p1->pos.y > p3->pos.y) std::swap(p1, p3);
-	if (p2->pos.y > p3->pos.y) std::swap(p2, p3);
-	if (p1->pos.y == p2->pos.y && p1->pos.y == p3->pos.y) return 0;
-	if (p1->pos.x == p2->pos.x && p1->pos.x == p3->pos.x) return 0;
-
-	traps.push_back(Trapezoid());
-	if (p1->pos.y == p2->pos.y) {	// triangle down
-		if (p1->pos.x > p2->pos.x) std::swap(p1, p2);
-		traps[0].top = p1->pos.y;
-		traps[0].bottom = p3->pos.y;
-		traps[0].left.v1 = XYZRhw(*p1);
-		traps[0].left.v2 = XYZRhw(*p3);
-		traps[0].right.v1 = XYZRhw(*p2);
-		traps[0].right.v2 = XYZRhw(*p3);
-		if (traps[0].top < traps[0].bottom) {
-			return 1;
+		int64_t area = (int64_t)(x_[1] - x_[0]) * (y_[2] - y_[0]) - (int64_t)(y_[1] - y_[0]) * (x_[2] - x_[0]);
+		if (area == 0) {
+			return kDegenerate;
 		}
-		else {
-			traps.clear();
-			return 0;
+		if (area < 0) {
+			std::swap(x_[1], x_[2]);
+			std::swap(y_[1], y_[2]);
 		}
-	}
 
-	if (p2->pos.y == p3->pos.y) {	// triangle up
-		if (p2->pos.x > p3->pos.x) std::swap(p2, p3);
-		traps[0].top = p1->pos.y;
-		traps[0].bottom = p3->pos.y;
-		traps[0].left.v1 = XYZRhw(*p1);
-		traps[0].left.v2 = XYZRhw(*p2);
-		traps[0].right.v1 = XYZRhw(*p1);
-		traps[0].right.v2 = XYZRhw(*p3);
-		if (traps[0].top < traps[0].bottom) {
-			return 1;
+		//pixel px has its center at px * kSubPixelOne + kSubPixelOne / 2
+		const int half = kSubPixelOne / 2;
+		xmin_ = (std::max)(0, ((std::min)({ x_[0], x_[1], x_[2] }) - half + kSubPixelOne - 1) >> kSubPixelBits);
+		ymin_ = (std::max)(0, ((std::min)({ y_[0], y_[1], y_[2] }) - half + kSubPixelOne - 1) >> kSubPixelBits);
+		xmax_ = (std::min)(width - 1, ((std::max)({ x_[0], x_[1], x_[2] }) - half) >> kSubPixelBits);
+		ymax_ = (std::min)(height - 1, ((std::max)({ y_[0], y_[1], y_[2] }) - half) >> kSubPixelBits);
+		if (xmin_ > xmax_ || ymin_ > ymax_) {
+			return kEmpty;
 		}
-		else {
-			traps.clear();
-			return 0;
+
+		for (int i = 0; i != 3; i++) {
+			int j = (i + 1) % 3;
+			dx_[i] = x_[j] - x_[i];
+			dy_[i] = y_[j] - y_[i];
+			//y grows downward, top edges run to the right and left edges run up
+			bias_[i] = ((dy_[i] == 0 && dx_[i] > 0) || dy_[i] < 0 ? 0 : 1);
 		}
-	}
 
-	traps.push_back(Trapezoid());
-	traps[0].top = p1->pos.y;
-	traps[0].bottom = p2->pos.y;
-	traps[1].top = p2->pos.y;
-	traps[1].bottom = p3->pos.y;
-
-	k = (p3->pos.y - p1->pos.y) / (p2->pos.y - p1->pos.y);
-	x = p1->pos.x + (p2->pos.x - p1->pos.x) * k;
-
-	if (x <= p3->pos.x) {		// triangle left
-		traps[0].left.v1 = XYZRhw(*p1);
-		traps[0].left.v2 = XYZRhw(*p2);
-		traps[0].right.v1 = XYZRhw(*p1);
-		traps[0].right.v2 = XYZRhw(*p3);
-		traps[1].left.v1 = XYZRhw(*p2);
-		traps[1].left.v2 = XYZRhw(*p3);
-		traps[1].right.v1 = XYZRhw(*p1);
-		traps[1].right.v2 = XYZRhw(*p3);
+		return kVisible;
 	}
-	else {					// triangle right
-		traps[0].left.v1 = XYZRhw(*p1);
-		traps[0].left.v2 = XYZRhw(*p3);
-		traps[0].right.v1 = XYZRhw(*p1);
-		traps[0].right.v2 = XYZRhw(*p2);
-		traps[1].left.v1 = XYZRhw(*p1);
-		traps[1].left.v2 = XYZRhw(*p3);
-		traps[1].right.v1 = XYZRhw(*p2);
-		traps[1].right.v2 = XYZRhw(*p3);
-	}
-
-	return 2;
-}
 
-
-//ÿһƬԪÿƬԪһ
-template<class FRAG>
-class TrapTraversal {
-public:
-	TrapTraversal(const Trapezoid& trap, int width, int height, std::vector<std::array<FRAG, 4> >& output) {
-		trap_ = &trap;
-		width_ = width;
-		height_ = height;
-		output_ = &output;
+	//fits in one quad of the traversal
+	bool tiny() const {
+		return (xmin_ >> 1) == (xmax_ >> 1) && (ymin_ >> 1) == (ymax_ >> 1);
 	}
 
-public:
-	void process() {
-		for (int i = (int)trap_->top; i <= (int)(trap_->bottom); i += 2) {
-			scan(i);
-		}
+	//edge function i at the center of pixel (px, py), biased by the fill rule, covered when all three are >= 0
+	int64_t edge(int i, int px, int py) const {
+		int64_t sx = (int64_t)px * kSubPixelOne + kSubPixelOne / 2;
+		int64_t sy = (int64_t)py * kSubPixelOne + kSubPixelOne / 2;
+		return (int64_t)dx_[i] * (sy - y_[i]) - (int64_t)dy_[i] * (sx - x_[i]) - bias_[i];
 	}
 
-private:
-	struct RangeLine {
-		Vector4f left, right;
-		int xb, xe;
-		bool visible;
-	};
-
-	void scan(int y0) {
-		int y1 = y0 + 1;
-		float yf0 = y0 + 0.5f;
-		float yf1 = y0 + 1.5f;
-
-		RangeLine rl0, rl1;
-
-		rl0.visible = (trap_->top <= yf0 && yf0 <= trap_->bottom && 0 <= y0 && y0 < height_);
-		rl1.visible = (trap_->top <= yf1 && yf1 <= trap_->bottom && 0 <= y1 && y1 < height_);
-
-		rl0.left = Lerp(trap_->left, yf0);
-		rl0.right = Lerp(trap_->right, yf0);
-		rl1.left = Lerp(trap_->left, yf1);
-		rl1.right = Lerp(trap_->right, yf1);
+	//change of edge function i one pixel to the right, one pixel down
+	int64_t stepX(int i) const {
+		return -(int64_t)dy_[i] * kSubPixelOne;
+	}
 
-		rl0.xb = (std::max)(0, (int)(rl0.left.x + 0.5f));
-		rl0.xe = (std::min)(width_, (int)(rl0.right.x + 0.5f));
-		rl1.xb = (std::max)(0, (int)(rl1.left.x + 0.5f));
-		rl1.xe = (std::min)(width_, (int)(rl1.right.x + 0.5f));
+	int64_t stepY(int i) const {
+		return (int64_t)dx_[i] * kSubPixelOne;
+	}
 
-		int xb = 0, xe = 0;
-		if (rl0.visible && rl1.visible) {
-			xb = (std::min)(rl0.xb, rl1.xb);
-			xe = (std::max)(rl0.xe, rl1.xe);
-		}
-		else if (rl0.visible) {
-			xb = rl0.xb;
-			xe = rl0.xe;
-		}
-		else if (rl1.visible) {
-			xb = rl1.xb;
-			xe = rl1.xe;
-		}
-		else {
-			return;
+	//covered samples of the quad at even pixel (x, y) as bits k = 2 * dy + dx, e holds the edge functions at (x, y)
+	//the traversal and the tiny triangle path both go through here so they cannot disagree on the fill rule
+	int quadMask(const int64_t e[3], int x, int y) const {
+		int mask = 0;
+		for (int k = 0; k != 4; k++) {
+			int kx = (k & 1), ky = (k >> 1);
+			bool inside = (x + kx <= xmax_ && y + ky <= ymax_);
+			for (int i = 0; i != 3 && inside; i++) {
+				inside = (e[i] + stepX(i) * kx + stepY(i) * ky >= 0);
+			}
+			mask |= (inside ? 1 << k : 0);
 		}
+		return mask;
+	}
 
-		for (int i = xb; i < xe; i += 2) {
-			float xf0 = i + 0.5f;
-			float xf1 = i + 1.5f;
+	int xmin() const { return xmin_; }
+	int ymin() const { return ymin_; }
+	int xmax() const { return xmax_; }
+	int ymax() const { return ymax_; }
 
-			//2, 3
-			//0, 1
-			std::array<FRAG, 4> tile;
-			fragAssign(xf0, yf0, rl0, tile[0]);
-			fragAssign(xf1, yf0, rl0, tile[1]);
-			fragAssign(xf0, yf1, rl1, tile[2]);
-			fragAssign(xf1, yf1, rl1, tile[3]);
+private:
+	int x_[3], y_[3];
+	int dx_[3], dy_[3], bias_[3];
+	int xmin_, ymin_, xmax_, ymax_;//inclusive
+};
 
-			output_->push_back(tile);
-		}
-	}
 
-	void fragAssign(float xf, float yf, const RangeLine& rl, FRAG& frag) {
-		frag.x = (int)xf;
-		frag.y = (int)yf;
-		float dx = rl.right.x - rl.left.x;
-		if (dx == 0.0f) dx = 0.000001f;
-		float s =  (xf - rl.left.x) / dx;
-		frag.z = Lerp(rl.left.z, rl.right.z, s);
-		frag.rhw = Lerp(rl.left.w, rl.right.w, s);
-		frag.weight = (rl.visible && (rl.xb <= frag.x && frag.x < rl.xe) ? 1.0f : 0.0f);
+//walks the bounding box in 2x2 quads at even pixels, stepping the edge functions incrementally
+//quads with no sample covered are skipped, weight tells the covered samples from the helpers
+template<class FRAG>
+class QuadTraversal {
+public:
+	QuadTraversal(const TriangleSetup& setup, std::vector<std::array<FRAG, 4> >& output) {
+		setup_ = &setup;
+		output_ = &output;
 	}
 
 public:
-	const Trapezoid* trap_;
-	int width_, height_;
-	std::vector<std::array<FRAG, 4> >* output_;
-};
+	void process() {
+		const TriangleSetup& setup = *setup_;
+		int x0 = setup.xmin() & ~1;
+		int y0 = setup.ymin() & ~1;
+
+		int64_t row[3], sx[3], sy[3];
+		for (int i = 0; i != 3; i++) {
+			row[i] = setup.edge(i, x0, y0);
+			sx[i] = setup.stepX(i);
+			sy[i] = setup.stepY(i);
+		}
 
+		for (int y = y0; y <= setup.ymax(); y += 2) {
+			int64_t e[3] = { row[0], row[1], row[2] };
+			for (int x = x0; x <= setup.xmax(); x += 2) {
+				//2, 3
+				//0, 1
+				int mask = setup.quadMask(e, x, y);
+
+				if (mask != 0) {
+					std::array<FRAG, 4> tile;
+					for (int k = 0; k != 4; k++) {
+						tile[k].x = x + (k & 1);
+						tile[k].y = y + (k >> 1);
+						tile[k].weight = (mask & (1 << k) ? 1.0f : 0.0f);
+					}
+					output_->push_back(tile);
+				}
+
+				for (int i = 0; i != 3; i++) {
+					e[i] += sx[i] * 2;
+				}
+			}
 
-template<class UL, class FRAG, class FS>
-class TileShader {
-public:
-	void process(const UL& u, std::array<FRAG, 4>& tile) {
-		sampler_.ddx_ = TexCoord(tile[1].varyings) - TexCoord(tile[0].varyings);
-		sampler_.ddy_ = TexCoord(tile[2].varyings) - TexCoord(tile[0].varyings);
-		for (int i = 0; i != 4; i++) {
-			if (0.0f < tile[i].weight) {
-				fragshader_.process(u, sampler_, tile[i]);
+			for (int i = 0; i != 3; i++) {
+				row[i] += sy[i] * 2;
 			}
 		}
 	}
 
-public:
-	SoftSampler sampler_;
-	FS fragshader_;
+private:
+	const TriangleSetup* setup_;
+	std::vector<std::array<FRAG, 4> >* output_;
 };
 
 
-template<class VERT, class FRAG>
+//p holds the screen x, y, z / w and 1 / w of a corner, its varyings are already divided by w
+template<class V, class FRAG>
 class LerpDerivative {
 public:
-	void setTriangle(const VERT& v0, const VERT& v1, const VERT& v2) {
-		VERT e01 = v1 - v0;
-		VERT e02 = v2 - v0;
+	void setTriangle(const Vector4f& p0, const Vector4f& p1, const Vector4f& p2, const V& v0, const V& v1, const V& v2) {
+		Vector4f e01 = p1 - p0;
+		Vector4f e02 = p2 - p0;
 
-		float area = e02.pos.x * e01.pos.y - e01.pos.x * e02.pos.y;
+		float area = e02.x * e01.y - e01.x * e02.y;
 		if (area == 0.0f) area = 0.000001f;
 		float inv_area = 1.0f / area;
 
+		p0_ = p0;
+		pddx_ = (e02 * e01.y - e01 * e02.y) * inv_area;
+		pddy_ = (e01 * e02.x - e02 * e01.x) * inv_area;
+
+		V ve01 = v1 - v0;
+		V ve02 = v2 - v0;
+
 		v0_ = v0;
-		ddx_ = (e02 * e01.pos.y - e01 * e02.pos.y) * inv_area;
-		ddy_ = (e01 * e02.pos.x - e02 * e01.pos.x) * inv_area;
+		vddx_ = (ve02 * e01.y - ve01 * e02.y) * inv_area;
+		vddy_ = (ve01 * e02.x - ve02 * e01.x) * inv_area;
 	}
 
-	void lerp(FRAG& frag) const {
-		float fx = frag.x + 0.5f;
-		float fy = frag.y + 0.5f;
-		float rhw = frag.rhw;
-		if (rhw == 0.0f) rhw = 0.000001f;
-		frag.varyings = (v0_.varyings + ddx_.varyings * (fx - v0_.pos.x) + ddy_.varyings * (fy - v0_.pos.y)) / rhw;
+	//z, rhw and varyings of a quad, only the first sample is evaluated from v0, the others are a step from it
+	//the varyings of each sample are divided by rhw through a single reciprocal
+	void lerp(std::array<FRAG, 4>& tile) const {
+		//2, 3
+		//0, 1
+		float dx = tile[0].x + 0.5f - p0_.x;
+		float dy = tile[0].y + 0.5f - p0_.y;
+
+		Vector4f p[4];
+		p[0] = p0_ + pddx_ * dx + pddy_ * dy;
+		p[1] = p[0] + pddx_;
+		p[2] = p[0] + pddy_;
+		p[3] = p[1] + pddy_;
+
+		V v[4];
+		v[0] = v0_ + vddx_ * dx + vddy_ * dy;
+		v[1] = v[0] + vddx_;
+		v[2] = v[0] + vddy_;
+		v[3] = v[1] + vddy_;
+
+		for (int k = 0; k != 4; k++) {
+			FRAG& frag = tile[k];
+			frag.z = p[k].z;
+			frag.rhw = p[k].w;
+
+			float rhw = frag.rhw;
+			if (rhw == 0.0f) rhw = 0.000001f;
+			frag.varyings = v[k] * (1.0f / rhw);
+		}
 	}
 
 private:
-	VERT v0_, ddy_, ddx_;
+	Vector4f p0_, pddx_, pddy_;
+	V v0_, vddx_, vddy_;
 };
 
 
-template<class UL, class A, class V, class CF, class FS>
+template<class UL, class A, class V, class CF, class DF, class FS, class I = uint32_t>
 class SoftRasterizerStage {
 public:
 	typedef typename CF::data_t color_data_t;
 	typedef typename CF::scalar_t color_scalar_t;
+	typedef typename DF::data_t depth_data_t;
 	typedef SoftVertex<A, V> vertex_t;
 	typedef SoftFragment<V, color_scalar_t> fragment_t;
 
@@ -275,115 +275,183 @@ public:
 		height_ = hh;
 		profiler_ = &profiler;
 
-		framebuffer_.resize(height_, nullptr);
-		zbuffer_.resize(height_);
-
-		for (int y = 0; y != height_; y++) {
-			zbuffer_[y].resize(width_, 0.0f);
-		}
-
-		color_data_t* framebuf = (color_data_t*)fb;
-		for (int i = 0; i < height_; i++) {
-			framebuffer_[i] = framebuf + width_ * i;
-		}
+		framebuffer_.reset(width_, height_);
+		zbuffer_.reset(width_, height_);
+		target_ = (color_data_t*)fb;
 	}
 
-	void process(SoftDrawCall<UL, A, V>& call) {
+	void process(SoftDrawCall<UL, A, V, I>& call) {
 		profiler_->count("Ras-Triangle Count", (int)call.prims.indexs_.size() / 3);
-		
-		//triangle setup, ʡ
 
+		counts_.fill(0);
+
+		const SoftVertexStream<4>& screens = call.prims.screens_;
 		for (size_t i = 0; i + 2 < call.prims.indexs_.size(); i += 3) {
 			//triangle traversal
 			//fragment shader
 			//merging
-			const size_t* tri = &call.prims.indexs_[i];
+			const I* tri = &call.prims.indexs_[i];
 
+			std::array<Vector4f, 3> p = { screens.vector4(tri[0]), screens.vector4(tri[1]), screens.vector4(tri[2]) };
 			const vertex_t& v1 = call.prims.verts_[tri[0]];
 			const vertex_t& v2 = call.prims.verts_[tri[1]];
 			const vertex_t& v3 = call.prims.verts_[tri[2]];
-			drawTriangle(call.uniforms, v1, v2, v3);
+			drawTriangle(call.uniforms, p, v1, v2, v3);
+		}
+
+		static const char* const kCountNames[kCountKinds] = {
+			"Ras-Triangle Degenerate", "Ras-Triangle Empty", "Ras-Triangle Out Of Range",
+			"Ras-Triangle Tiny", "Frag Count", "Frag-Sharder Excuted"
+		};
+		for (int k = 0; k != kCountKinds; k++) {
+			if (counts_[k] != 0) {
+				profiler_->count(kCountNames[k], counts_[k]);
+			}
 		}
+
+		SoftTextureCache::report(*profiler_);
 	}
 
+	//lazy, the tiles are written when first drawn to or at resolve
 	void clean() {
-		for (int y = 0; y < height_; y++) {
-			color_data_t *dst = framebuffer_[y];
-			for (int x = width_; x > 0; dst++, x--) dst[0] = CF::data(CF::clean());
-		}
+		framebuffer_.clear(CF::data(CF::clean()));
+		zbuffer_.clear(DF::data(DF::clean()));
+	}
 
-		for (int y = 0; y < height_; y++) {
-			std::vector<float>& dst = zbuffer_[y];
-			std::fill(dst.begin(), dst.end(), 1.0f);
-		}
+	//copies the tiled color buffer to the viewer's frame buffer, once all draw calls are done
+	void resolve() {
+		framebuffer_.resolve(target_, width_);
 	}
 
 private:
-	void drawTriangle(const UL& u, vertex_t v0, vertex_t v1, vertex_t v2) {
-		v0.rhwInitialize();
-		v1.rhwInitialize();
-		v2.rhwInitialize();
+	//per draw call, zeroed before its triangles and reported after them when non-zero
+	enum {
+		kCountDegenerate,
+		kCountEmpty,
+		kCountOutOfRange,
+		kCountTiny,
+		kCountFrags,
+		kCountShaded,
+		kCountKinds,
+	};
 
-		LerpDerivative<vertex_t, fragment_t> lerpd;
-		lerpd.setTriangle(v0, v1, v2);
+	//the geometry stage hands over screen positions as x, y, z / w, 1 / w and varyings already divided by w
+	void drawTriangle(const UL& u, const std::array<Vector4f, 3>& p, const vertex_t& v0, const vertex_t& v1, const vertex_t& v2) {
+		//triangle setup
+		//triangles that cover no pixel center stop here, before any interpolation is set up
+		TriangleSetup setup;
+		int state = setup.reset(p[0], p[1], p[2], width_, height_);
+		if (state == TriangleSetup::kDegenerate) {
+			counts_[kCountDegenerate]++;
+			return;
+		}
+		if (state == TriangleSetup::kEmpty) {
+			counts_[kCountEmpty]++;
+			return;
+		}
+		if (state == TriangleSetup::kOutOfRange) {
+			counts_[kCountOutOfRange]++;
+			return;
+		}
 
-		std::vector<Trapezoid> traps;
-		SpliteTrapezoid(v0, v1, v2, traps);
+		LerpDerivative<V, fragment_t> lerpd;
+		lerpd.setTriangle(p[0], p[1], p[2], v0.varyings, v1.varyings, v2.varyings);
 
-		for (auto i = traps.begin(); i != traps.end(); i++) {
-			drawTrapezoid(u, lerpd, *i);
+		if (setup.tiny()) {
+			counts_[kCountTiny]++;
+			drawTiny(u, lerpd, setup);
+			return;
 		}
-	}
 
-	void drawTrapezoid(const UL& u, const LerpDerivative<vertex_t, fragment_t>& lerpd, Trapezoid& trap) {
-		std::vector<std::array<fragment_t, 4> > tiles;
+		//triangle traversal
+		tiles_.clear();
+		QuadTraversal<fragment_t>(setup, tiles_).process();
 
-		TrapTraversal<fragment_t>(trap, width_, height_, tiles).process();
-
-		profiler_->count("Frag Count", (int)(4 * tiles.size()));
-		for (auto i = tiles.begin(); i != tiles.end(); i++) {
-			int incr = 0;
-			incr += (0.0f < (*i)[0].weight ? 1 : 0);
-			incr += (0.0f < (*i)[1].weight ? 1 : 0);
-			incr += (0.0f < (*i)[2].weight ? 1 : 0);
-			incr += (0.0f < (*i)[3].weight ? 1 : 0);
-			profiler_->count("Frag-Sharder Excuted", incr);
+		counts_[kCountFrags] += (int)(4 * tiles_.size());
+		for (auto i = tiles_.begin(); i != tiles_.end(); i++) {
+			for (int k = 0; k != 4; k++) {
+				counts_[kCountShaded] += (0.0f < (*i)[k].weight ? 1 : 0);
+			}
 		}
 
 		//fragment lerp
 		//fragment sharding
 		auto frag_lerp_and_sharding = [&](std::array<fragment_t, 4>& tile) {
-			lerpd.lerp(tile[0]);
-			lerpd.lerp(tile[1]);
-			lerpd.lerp(tile[2]);
-			lerpd.lerp(tile[3]);
+			lerpd.lerp(tile);
 
 			TileShader<UL, fragment_t, FS>().process(u, tile);
 		};
 
-		Concurrency::parallel_for_each(tiles.begin(), tiles.end(), frag_lerp_and_sharding);
+		Concurrency::parallel_for_each(tiles_.begin(), tiles_.end(), frag_lerp_and_sharding);
 
-		//merging
-		for (auto i = tiles.begin(); i != tiles.end(); i++) {
+		//merging, in order so the result does not depend on the threads
+		for (auto i = tiles_.begin(); i != tiles_.end(); i++) {
 			merge(*i);
 		}
 	}
 
+	//the single quad of the triangle, shaded on this thread without the tile list
+	void drawTiny(const UL& u, const LerpDerivative<V, fragment_t>& lerpd, const TriangleSetup& setup) {
+		//2, 3
+		//0, 1
+		int x = setup.xmin() & ~1;
+		int y = setup.ymin() & ~1;
+		int64_t e[3];
+		for (int i = 0; i != 3; i++) {
+			e[i] = setup.edge(i, x, y);
+		}
+		int mask = setup.quadMask(e, x, y);
+
+		std::array<fragment_t, 4> tile;
+		int incr = 0;
+		for (int k = 0; k != 4; k++) {
+			fragment_t& frag = tile[k];
+			frag.x = x + (k & 1);
+			frag.y = y + (k >> 1);
+			frag.weight = (mask & (1 << k) ? 1.0f : 0.0f);
+			incr += (mask >> k) & 1;
+		}
+
+		counts_[kCountFrags] += 4;
+		counts_[kCountShaded] += incr;
+		if (incr == 0) {
+			return;
+		}
+
+		lerpd.lerp(tile);
+
+		TileShader<UL, fragment_t, FS>().process(u, tile);
+		merge(tile);
+	}
+
 	void merge(const std::array<fragment_t, 4>& tile) {
+		//a quad never straddles two tiles
+		zbuffer_.touch(tile[0].x, tile[0].y);
+		framebuffer_.touch(tile[0].x, tile[0].y);
+
 		for (size_t i = 0; i != 4; i++) {
 			const fragment_t& frag = tile[i];
-			if (frag.weight != 0.0f && frag.z < zbuffer_[frag.y][frag.x]) {
-				zbuffer_[frag.y][frag.x] = frag.z;
-				framebuffer_[frag.y][frag.x] = CF::data(frag.c);
+			if (frag.weight == 0.0f) {
+				continue;
+			}
+
+			depth_data_t z = DF::data(frag.z);
+			depth_data_t& d = zbuffer_.at(frag.x, frag.y);
+			if (DF::less(z, d)) {
+				d = DF::merge(z, d);
+				framebuffer_.at(frag.x, frag.y) = CF::data(frag.c);
 			}
 		}
 	}
 
 private:
-	std::vector<color_data_t*> framebuffer_;
-	std::vector<std::vector<float> > zbuffer_;
+	SoftTiledBuffer<color_data_t> framebuffer_;
+	SoftTiledBuffer<depth_data_t> zbuffer_;
+	color_data_t* target_;//the viewer's, row-major
 	int width_, height_;
 	Profiler* profiler_;
+	std::vector<std::array<fragment_t, 4> > tiles_;//of the triangle being drawn
+	std::array<int, kCountKinds> counts_;
 };
 
 
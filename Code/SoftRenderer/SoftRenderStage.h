@@ -8,7 +8,7 @@
 SHAKURAS_BEGIN;
 
 
-template<class UL, class A, class V, class CF, class VS, class FS>
+template<class UL, class A, class V, class CF, class DF, class VS, class FS, class I = uint32_t>
 class SoftRenderStage {
 public:
 	template<class VPTR>
@@ -17,18 +17,20 @@ public:
 		rasstage_.initialize(viewer->width(), viewer->height(), viewer->frameBuffer(), profiler);
 	}
 
-	void process(std::vector<SoftDrawCall<UL, A, V> >& calls) {
+	void process(std::vector<SoftDrawCall<UL, A, V, I> >& calls) {
 		rasstage_.clean();
 
 		for (auto i = calls.begin(); i != calls.end(); i++) {
 			geostage_.process(*i);
 			rasstage_.process(*i);
 		}
+
+		rasstage_.resolve();
 	}
 
 public:
-	SoftGeometryStage<UL, A, V, VS> geostage_;
-	SoftRasterizerStage<UL, A, V, CF, FS> rasstage_;
+	SoftGeometryStage<UL, A, V, VS, I> geostage_;
+	SoftRasterizerStage<UL, A, V, CF, DF, FS, I> rasstage_;
 };
 
 
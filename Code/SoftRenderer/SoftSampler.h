@@ -34,15 +34,21 @@ public:
 	}
 
 	template<class CF, typename AF>
-	typename CF::scalar_t mipmapAniso(float u, float v, const SoftMipmap<CF>& mipmap, AF addressing) {
-		return AnisoSample(u, v, ddx_, ddy_, mipmap, addressing);
+	typename CF::scalar_t mipmapAniso(float u, float v, const SoftMipmap<CF>& mipmap, int max_aniso, AF addressing) {
+		return AnisoSample(u, v, ddx_, ddy_, max_aniso, false, mipmap, addressing);
+	}
+
+	template<class CF, typename AF>
+	typename CF::scalar_t mipmapAnisoTrilinear(float u, float v, const SoftMipmap<CF>& mipmap, int max_aniso, AF addressing) {
+		return AnisoSample(u, v, ddx_, ddy_, max_aniso, true, mipmap, addressing);
 	}
 
 	enum SampleCat {
 		kNearest = 0,
 		kBilinear = 1,
 		kTrilinear = 2,
-		kAniso = 3
+		kAniso = 3,
+		kAnisoTrilinear = 4
 	};
 
 	enum AddresingCat {
@@ -51,7 +57,7 @@ public:
 	};
 
 	template<class TEX>
-	typename TEX::format_t::scalar_t sample(float u, float v, const TEX& tex, int sample_cat, int addr_cat) {
+	typename TEX::format_t::scalar_t sample(float u, float v, const TEX& tex, int sample_cat, int addr_cat, int max_aniso = MAX_ANISOTROPY) {
 
 		typedef std::function<void(float& u, float& v)> AF;
 		AF addressing;
@@ -80,7 +86,10 @@ public:
 			r = this->mipmapTrilinear(u, v, tex, addressing);
 			break;
 		case kAniso:
-			r = this->mipmapAniso(u, v, tex, addressing);
+			r = this->mipmapAniso(u, v, tex, max_aniso, addressing);
+			break;
+		case kAnisoTrilinear:
+			r = this->mipmapAnisoTrilinear(u, v, tex, max_aniso, addressing);
 			break;
 		default:
 			break;
@@ -1,5 +1,6 @@
 #pragma once
 #include "SoftColorFormat.h"
+#include "SoftTextureCache.h"
 #include <vector>
 #include <math.h>
 #include <assert.h>
@@ -65,6 +66,7 @@ public:
 	inline void sets(int x, int y, const scalar_t& c) { data_[y * width_ + x] = CF::data(c); }
 
 	inline void* buffer() { return (void*)data_.data(); }
+	inline const data_t* data() const { return data_.data(); }
 
 private:
 	std::vector<data_t> data_;
@@ -72,6 +74,52 @@ private:
 };
 
 
+//read-only view of texels owned elsewhere, e.g. one level of a SoftMipmap
+//texels are either stored as data_t or as BC1/BC3 blocks decoded on fetch
+//fetches go through the per-thread SoftTextureCache for block formats, or when it is enabled
+template<class CF>
+class SoftSurfaceView {
+public:
+	typedef CF format_t;
+	typedef typename CF::data_t data_t;
+	typedef typename CF::scalar_t scalar_t;
+
+public:
+	SoftSurfaceView() : bits_(nullptr), width_(0), height_(0), block_(kBlockNone), stamp_(0), level_(0) {}
+	SoftSurfaceView(const data_t* data, int ww, int hh)
+		: bits_((const uint8_t*)data), width_(ww), height_(hh), block_(kBlockNone), stamp_(0), level_(0) {}
+	SoftSurfaceView(const uint8_t* bits, int ww, int hh, int block, uint32_t stamp, int level)
+		: bits_(bits), width_(ww), height_(hh), block_(block), stamp_(stamp), level_(level) {}
+
+public:
+	inline int width() const { return width_; }
+	inline int height() const { return height_; }
+	inline int block() const { return block_; }
+	inline uint32_t stamp() const { return stamp_; }
+	inline int levelIndex() const { return level_; }
+
+	inline data_t getd(int x, int y) const {
+		//views without a stamp are not owned by a mipmap and never cached
+		if (block_ == kBlockNone && (sizeof(data_t) != sizeof(uint32_t) || stamp_ == 0 || !SoftTextureCache::enabled())) {
+			return ((const data_t*)bits_)[y * width_ + x];
+		}
+		return (data_t)SoftTextureCache::local().fetch(*this, x, y);
+	}
+	inline scalar_t gets(int x, int y) const { return CF::scalar(getd(x, y)); }
+
+	//only valid for kBlockNone
+	inline const data_t* data() const { return (const data_t*)bits_; }
+	inline const uint8_t* bits() const { return bits_; }
+
+private:
+	const uint8_t* bits_;
+	int width_, height_;
+	int block_;
+	uint32_t stamp_;
+	int level_;
+};
+
+
 typedef SoftSurface<ColorFormatU32F3> SoftSurfaceU32F3;
 SHAKURAS_SHARED_PTR(SoftSurfaceU32F3);
 
@@ -87,8 +135,8 @@ inline uint32_t Swap02(uint32_t d) {
 }
 
 
-template<class CF, typename AF>
-typename CF::scalar_t NearestSample(float u, float v, const SoftSurface<CF>& surface, AF addressing) {
+template<class S, typename AF>
+typename S::scalar_t NearestSample(float u, float v, const S& surface, AF addressing) {
 	addressing(u, v);
 
 	u *= (surface.width() - 1);
@@ -101,8 +149,8 @@ typename CF::scalar_t NearestSample(float u, float v, const SoftSurface<CF>& sur
 }
 
 
-template<class CF, typename AF>
-typename CF::scalar_t BilinearSample(float u, float v, const SoftSurface<CF>& surface, AF addressing) {
+template<class S, typename AF>
+typename S::scalar_t BilinearSample(float u, float v, const S& surface, AF addressing) {
 	addressing(u, v);
 
 	u *= (surface.width() - 1);
@@ -114,7 +162,7 @@ typename CF::scalar_t BilinearSample(float u, float v, const SoftSurface<CF>& su
 	int cx_mod = cx % surface.width();
 	int cy_mod = cy % surface.height();
 
-	typedef typename CF::scalar_t scalar_t;
+	typedef typename S::scalar_t scalar_t;
 
 	scalar_t lbc = surface.gets(fx, fy);//
 	scalar_t rbc = surface.gets(cx_mod, fy);//
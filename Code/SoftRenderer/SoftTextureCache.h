@@ -0,0 +1,168 @@
+#pragma once
+#include "SoftBlockCompression.h"
+#include "Core/Profiler.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+SHAKURAS_BEGIN;
+
+
+//unique per allocation, so a freed and reused address never hits stale cache lines
+inline uint32_t NextStorageStamp() {
+	static std::atomic<uint32_t> stamp(0);
+	return ++stamp;
+}
+
+
+//per-thread cache of decoded 4x4 tiles, keyed by (texture stamp, level, tile)
+//block-compressed levels always go through it, uncompressed ones only when enabled
+class SoftTextureCache {
+public:
+	SoftTextureCache() {
+		for (size_t i = 0; i != kLineCount; i++) {
+			lines_[i].stamp = 0;
+			lines_[i].level = -1;
+			lines_[i].tile = 0;
+		}
+		hits_ = 0;
+		misses_ = 0;
+		reported_hits_ = 0;
+		reported_misses_ = 0;
+
+		Registry& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.caches.push_back(this);
+	}
+
+	~SoftTextureCache() {
+		Registry& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.retired_hits += hits_.load() - reported_hits_;
+		reg.retired_misses += misses_.load() - reported_misses_;
+		reg.caches.erase(std::find(reg.caches.begin(), reg.caches.end(), this));
+	}
+
+	SoftTextureCache(const SoftTextureCache&) = delete;
+	SoftTextureCache& operator=(const SoftTextureCache&) = delete;
+
+public:
+	//S is a SoftSurfaceView with 32 bits texels
+	template<class S>
+	inline uint32_t fetch(const S& surface, int x, int y) {
+		int tiles_x = (surface.width() + 3) / 4;
+		uint32_t tile = (uint32_t)((y >> 2) * tiles_x + (x >> 2));
+
+		uint32_t hash = tile * 0x9E3779B1u ^ surface.stamp() * 0x85EBCA6Bu ^ (uint32_t)surface.levelIndex() * 0xC2B2AE35u;
+		Line& line = lines_[(hash >> 16) & (kLineCount - 1)];
+
+		//owner-only counters, relaxed store is enough
+		if (line.stamp == surface.stamp() && line.level == surface.levelIndex() && line.tile == tile) {
+			hits_.store(hits_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		else {
+			misses_.store(misses_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			fill(surface, x >> 2, y >> 2, tile, line);
+		}
+
+		return line.texels[(y & 3) * 4 + (x & 3)];
+	}
+
+	static SoftTextureCache& local() {
+		static thread_local SoftTextureCache cache;
+		return cache;
+	}
+
+	static bool enabled() {
+		return switcher().load(std::memory_order_relaxed);
+	}
+
+	static void enable(bool e) {
+		switcher().store(e);
+	}
+
+	//hits and misses of all threads since the last report
+	static void report(Profiler& profiler) {
+		uint64_t hits = 0, misses = 0;
+
+		Registry& reg = registry();
+		{
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			for (auto i = reg.caches.begin(); i != reg.caches.end(); i++) {
+				uint64_t h = (*i)->hits_.load();
+				uint64_t m = (*i)->misses_.load();
+				hits += h - (*i)->reported_hits_;
+				misses += m - (*i)->reported_misses_;
+				(*i)->reported_hits_ = h;
+				(*i)->reported_misses_ = m;
+			}
+			hits += reg.retired_hits;
+			misses += reg.retired_misses;
+			reg.retired_hits = 0;
+			reg.retired_misses = 0;
+		}
+
+		if (hits + misses != 0) {
+			profiler.count("TexCache Hit", (int)hits);
+			profiler.count("TexCache Miss", (int)misses);
+		}
+	}
+
+private:
+	static const size_t kLineCount = 256;
+
+	struct Line {
+		uint32_t stamp;
+		int level;
+		uint32_t tile;
+		uint32_t texels[16];
+	};
+
+	struct Registry {
+		Registry() : retired_hits(0), retired_misses(0) {}
+		std::mutex mutex;
+		std::vector<SoftTextureCache*> caches;
+		uint64_t retired_hits, retired_misses;
+	};
+
+	static Registry& registry() {
+		static Registry reg;
+		return reg;
+	}
+
+	static std::atomic<bool>& switcher() {
+		static std::atomic<bool> e(false);
+		return e;
+	}
+
+	template<class S>
+	void fill(const S& surface, int tx, int ty, uint32_t tile, Line& line) {
+		line.stamp = surface.stamp();
+		line.level = surface.levelIndex();
+		line.tile = tile;
+
+		if (surface.block() != kBlockNone) {
+			DecodeBlock(surface.block(), surface.bits() + tile * BlockBytes(surface.block()), line.texels);
+			return;
+		}
+
+		//edge tiles repeat the last row/column
+		const uint32_t* texels = (const uint32_t*)surface.bits();
+		for (int j = 0; j != 4; j++) {
+			int yy = (std::min)(ty * 4 + j, surface.height() - 1);
+			for (int i = 0; i != 4; i++) {
+				int xx = (std::min)(tx * 4 + i, surface.width() - 1);
+				line.texels[j * 4 + i] = texels[yy * surface.width() + xx];
+			}
+		}
+	}
+
+private:
+	std::array<Line, kLineCount> lines_;
+	std::atomic<uint64_t> hits_, misses_;
+	uint64_t reported_hits_, reported_misses_;//guarded by registry mutex
+};
+
+
+SHAKURAS_END;
\ No newline at end of file
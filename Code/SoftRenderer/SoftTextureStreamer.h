@@ -0,0 +1,77 @@
+#pragma once
+#include "SoftMipmap.h"
+#include <atomic>
+#include <functional>
+#include <ppl.h>
+
+
+SHAKURAS_BEGIN;
+
+
+//decodes textures on background threads
+//the returned mipmaps can be drawn at once, they sharpen as their levels are published, see SoftMipmap::stream
+template<class CF>
+class SoftTextureStreamer {
+public:
+	typedef typename CF::data_t data_t;
+	typedef SoftSurface<CF> surface_t;
+	typedef SoftMipmap<CF> mipmap_t;
+	typedef std::function<bool(data_t* level0, int w, int h)> decoder_t;
+	typedef std::function<void(const mipmap_t& mipmap)> done_t;
+
+public:
+	SoftTextureStreamer(int block = kBlockNone, data_t placeholder = data_t()) : block_(block), placeholder_(placeholder), pending_(0) {}
+	//wait() rethrows what a task threw, which must not leave a destructor
+	~SoftTextureStreamer() {
+		try {
+			tasks_.wait();
+		}
+		catch (...) {
+		}
+	}
+
+	SoftTextureStreamer(const SoftTextureStreamer&) = delete;
+	SoftTextureStreamer& operator=(const SoftTextureStreamer&) = delete;
+
+public:
+	//w/h come from the image header, decoder runs on a worker thread and writes level 0 in place
+	//done runs on the same thread once every level is resident, e.g. to cache the chain
+	std::shared_ptr<mipmap_t> request(int w, int h, decoder_t decoder, done_t done = nullptr) {
+		if (w <= 0 || h <= 0 || !decoder) {
+			return nullptr;
+		}
+
+		std::shared_ptr<mipmap_t> mipmap = std::make_shared<mipmap_t>();
+		mipmap->prepare(w, h, block_, placeholder_);
+
+		pending_++;
+		tasks_.run([this, mipmap, decoder, done, w, h]() {
+			mipmap->stream([&](data_t* level0) {
+				return decoder(level0, w, h);
+			});
+			if (done && mipmap->resident()) {
+				done(*mipmap);
+			}
+			pending_--;
+		});
+
+		return mipmap;
+	}
+
+	inline int pending() const { return pending_.load(); }
+
+	void wait() { tasks_.wait(); }
+
+private:
+	int block_;
+	data_t placeholder_;
+	std::atomic<int> pending_;
+	Concurrency::task_group tasks_;
+};
+
+
+typedef SoftTextureStreamer<ColorFormatU32F3> SoftTextureStreamerU32F3;
+SHAKURAS_SHARED_PTR(SoftTextureStreamerU32F3);
+
+
+SHAKURAS_END;
\ No newline at end of file
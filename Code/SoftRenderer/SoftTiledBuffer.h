@@ -0,0 +1,103 @@
+#pragma once
+#include "Core/Utility.h"
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+#include <ppl.h>
+
+
+SHAKURAS_BEGIN;
+
+
+//pixels along a side of a tile, a 2x2 quad at even pixels never straddles two tiles
+const int kTileBits = 3;
+const int kTileSize = 1 << kTileBits;
+
+
+//a render target stored tile by tile, each tile contiguous and cache line aligned
+//the tiles along the right and bottom edges are allocated whole, their extra pixels are never resolved
+template<class T>
+class SoftTiledBuffer {
+public:
+	SoftTiledBuffer() : width_(0), height_(0), tiles_x_(0), tiles_y_(0), clear_value_() {}
+
+public:
+	void reset(int width, int height) {
+		width_ = width;
+		height_ = height;
+		tiles_x_ = (width + kTileSize - 1) >> kTileBits;
+		tiles_y_ = (height + kTileSize - 1) >> kTileBits;
+		data_.resize((size_t)tiles_x_ * tiles_y_ * kTileSize * kTileSize);
+		cleared_.assign((size_t)tiles_x_ * tiles_y_, 0);
+	}
+
+	inline T& at(int x, int y) {
+		return data_[offset(x, y)];
+	}
+
+	inline const T& at(int x, int y) const {
+		return data_[offset(x, y)];
+	}
+
+	//only flags the tiles, a tile takes the value when first touched
+	void clear(const T& v) {
+		clear_value_ = v;
+		std::fill(cleared_.begin(), cleared_.end(), (uint8_t)1);
+	}
+
+	//call before at() on a pixel of a tile that may still be cleared
+	inline void touch(int x, int y) {
+		size_t t = (size_t)(y >> kTileBits) * tiles_x_ + (x >> kTileBits);
+		if (cleared_[t]) {
+			cleared_[t] = 0;
+			std::fill_n(data_.data() + (t << (2 * kTileBits)), kTileSize * kTileSize, clear_value_);
+		}
+	}
+
+	//writes the tiles to a row-major image of pitch elements per row
+	//tiles never touched since the clear are filled straight from the clear value
+	void resolve(T* dst, int pitch) const {
+		Concurrency::parallel_for(0, tiles_y_, [&](int ty) {
+			int rows = (std::min)(kTileSize, height_ - (ty << kTileBits));
+			for (int tx = 0; tx != tiles_x_; tx++) {
+				int cols = (std::min)(kTileSize, width_ - (tx << kTileBits));
+				T* out = dst + (size_t)(ty << kTileBits) * pitch + (tx << kTileBits);
+				if (cleared_[(size_t)ty * tiles_x_ + tx]) {
+					for (int r = 0; r != rows; r++) {
+						std::fill_n(out + (size_t)r * pitch, cols, clear_value_);
+					}
+					continue;
+				}
+
+				const T* src = tile(tx, ty);
+				for (int r = 0; r != rows; r++) {
+					memcpy(out + (size_t)r * pitch, src + r * kTileSize, cols * sizeof(T));
+				}
+			}
+		});
+	}
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+
+private:
+	inline size_t offset(int x, int y) const {
+		size_t t = (size_t)(y >> kTileBits) * tiles_x_ + (x >> kTileBits);
+		return (t << (2 * kTileBits)) + ((y & (kTileSize - 1)) << kTileBits) + (x & (kTileSize - 1));
+	}
+
+	inline const T* tile(int tx, int ty) const {
+		return data_.data() + (((size_t)ty * tiles_x_ + tx) << (2 * kTileBits));
+	}
+
+private:
+	int width_, height_;
+	int tiles_x_, tiles_y_;
+	std::vector<T, AlignedAllocator<T, kCacheLineSize> > data_;
+	std::vector<uint8_t> cleared_;//per tile, its pixels are clear_value_ whatever data_ holds
+	T clear_value_;
+};
+
+
+SHAKURAS_END;
\ No newline at end of file
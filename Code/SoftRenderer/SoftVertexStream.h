@@ -0,0 +1,154 @@
+#pragma once
+#include "Core/MathAndGeometry.h"
+#include "Core/Utility.h"
+#include <array>
+#include <vector>
+#include <xmmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+
+SHAKURAS_BEGIN;
+
+
+//vertices one kernel step handles, 8 with /arch:AVX, else 4
+#ifdef __AVX__
+typedef __m256 simd_t;
+const size_t kStreamBatch = 8;
+
+inline simd_t SimdLoad(const float* p) { return _mm256_load_ps(p); }
+inline void SimdStore(float* p, simd_t a) { _mm256_store_ps(p, a); }
+inline simd_t SimdSet1(float s) { return _mm256_set1_ps(s); }
+inline simd_t SimdAdd(simd_t a, simd_t b) { return _mm256_add_ps(a, b); }
+inline simd_t SimdSub(simd_t a, simd_t b) { return _mm256_sub_ps(a, b); }
+inline simd_t SimdMul(simd_t a, simd_t b) { return _mm256_mul_ps(a, b); }
+inline simd_t SimdDiv(simd_t a, simd_t b) { return _mm256_div_ps(a, b); }
+#else
+typedef __m128 simd_t;
+const size_t kStreamBatch = 4;
+
+inline simd_t SimdLoad(const float* p) { return _mm_load_ps(p); }
+inline void SimdStore(float* p, simd_t a) { _mm_store_ps(p, a); }
+inline simd_t SimdSet1(float s) { return _mm_set1_ps(s); }
+inline simd_t SimdAdd(simd_t a, simd_t b) { return _mm_add_ps(a, b); }
+inline simd_t SimdSub(simd_t a, simd_t b) { return _mm_sub_ps(a, b); }
+inline simd_t SimdMul(simd_t a, simd_t b) { return _mm_mul_ps(a, b); }
+inline simd_t SimdDiv(simd_t a, simd_t b) { return _mm_div_ps(a, b); }
+#endif
+
+
+typedef std::vector<float, AlignedAllocator<float, kCacheLineSize> > SoftFloatArray;
+
+//vertices per task of the shading pass, small enough to stay in cache from one kernel to the next
+const size_t kStreamChunk = 256;
+
+
+//N components of a vertex attribute, each in its own aligned array
+//the arrays are padded to whole batches, so kernels run on [begin, end) rounded up to kStreamBatch
+template<int N>
+class SoftVertexStream {
+public:
+	SoftVertexStream() : count_(0) {}
+
+public:
+	void resize(size_t count) {
+		count_ = count;
+		size_t padded = (count + kStreamBatch - 1) / kStreamBatch * kStreamBatch;
+		for (auto i = channels_.begin(); i != channels_.end(); i++) {
+			i->resize(padded);
+		}
+	}
+
+	size_t size() const {
+		return count_;
+	}
+
+	float* operator[](int c) {
+		return channels_[c].data();
+	}
+
+	const float* operator[](int c) const {
+		return channels_[c].data();
+	}
+
+	//the first four channels of element i, for the scalar code around the kernels
+	Vector4f vector4(size_t i) const {
+		static_assert(N >= 4, "four channels at least");
+		return Vector4f(channels_[0][i], channels_[1][i], channels_[2][i], channels_[3][i]);
+	}
+
+	void setVector4(size_t i, const Vector4f& v) {
+		static_assert(N >= 4, "four channels at least");
+		channels_[0][i] = v.x;
+		channels_[1][i] = v.y;
+		channels_[2][i] = v.z;
+		channels_[3][i] = v.w;
+	}
+
+private:
+	std::array<SoftFloatArray, N> channels_;
+	size_t count_;
+};
+
+
+//out = in * m, with the summation order of Matrix44::transform, in and out may be the same stream
+inline void TransformStream(const Matrix44f& m, const SoftVertexStream<4>& in, SoftVertexStream<4>& out, size_t begin, size_t end) {
+	simd_t col[4][4];
+	for (int r = 0; r != 4; r++) {
+		for (int c = 0; c != 4; c++) {
+			col[r][c] = SimdSet1(m.m[r][c]);
+		}
+	}
+
+	for (size_t i = begin; i < end; i += kStreamBatch) {
+		simd_t x = SimdLoad(in[0] + i);
+		simd_t y = SimdLoad(in[1] + i);
+		simd_t z = SimdLoad(in[2] + i);
+		simd_t w = SimdLoad(in[3] + i);
+
+		for (int c = 0; c != 4; c++) {
+			simd_t r = SimdMul(x, col[0][c]);
+			r = SimdAdd(r, SimdMul(y, col[1][c]));
+			r = SimdAdd(r, SimdMul(z, col[2][c]));
+			r = SimdAdd(r, SimdMul(w, col[3][c]));
+			SimdStore(out[c] + i, r);
+		}
+	}
+}
+
+
+//clip space to pixels, x and y scaled to the viewport, z divided by w, 1 / w in the fourth channel
+inline void ScreenMapStream(const SoftVertexStream<4>& clip, SoftVertexStream<4>& screen, float width, float height, size_t begin, size_t end) {
+	const simd_t one = SimdSet1(1.0f);
+	const simd_t half = SimdSet1(0.5f);
+	const simd_t vw = SimdSet1(width);
+	const simd_t vh = SimdSet1(height);
+
+	for (size_t i = begin; i < end; i += kStreamBatch) {
+		simd_t w = SimdLoad(clip[3] + i);
+		simd_t rhw = SimdDiv(one, w);
+
+		simd_t x = SimdMul(SimdMul(SimdAdd(SimdMul(SimdLoad(clip[0] + i), rhw), one), vw), half);
+		simd_t y = SimdMul(SimdMul(SimdSub(one, SimdMul(SimdLoad(clip[1] + i), rhw)), vh), half);
+		simd_t z = SimdMul(SimdLoad(clip[2] + i), rhw);
+
+		SimdStore(screen[0] + i, x);
+		SimdStore(screen[1] + i, y);
+		SimdStore(screen[2] + i, z);
+		SimdStore(screen[3] + i, rhw);
+	}
+}
+
+
+//vertex shaders that transform positions on streams specialize this with streamed = true and provide
+//	void processPositions(const UL&, const SoftVertexStream<4>& in, SoftVertexStream<4>& out, size_t begin, size_t end);//in place
+//	void processVaryings(const UL&, const SoftVertexStream<4>& in, SoftVertex<A, V>* verts, size_t begin, size_t end);//everything but the position
+//processVaryings runs first and reads the input positions from in, verts[i].pos is left alone
+template<class VS>
+struct SoftVertexShaderTraits {
+	static const bool streamed = false;
+};
+
+
+SHAKURAS_END;
\ No newline at end of file